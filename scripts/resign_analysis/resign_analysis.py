@@ -104,7 +104,8 @@ def parseGames(filenames, resignthr, verbose, prefixes):
         training_filename = filename.replace(".debug", "")
         with open(filename) as fh, open(training_filename) as tfh:
             version = fh.readline().rstrip()
-            assert version == "2"
+            # Version 3 only changes the symmetry of the net winrate.
+            assert version in ("2", "3")
             (cfg_resignpct, network) = fh.readline().split()
             if prefixes:
                 net_name = os.path.basename(network)
@@ -0,0 +1,196 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BatchAnalysis.h"
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "GameState.h"
+#include "SGFParser.h"
+#include "SGFTree.h"
+#include "ThreadPool.h"
+#include "Timing.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+namespace {
+    struct Game {
+        std::string filename;
+        size_t index;
+        std::unique_ptr<SGFTree> tree;
+    };
+
+    struct Position {
+        const Game* game;
+        size_t movenum;
+    };
+
+    std::vector<std::string> find_sgf_files(const std::string& path) {
+        namespace fs = boost::filesystem;
+        auto files = std::vector<std::string>{};
+        if (!fs::is_directory(path)) {
+            files.emplace_back(path);
+            return files;
+        }
+        for (const auto& entry : fs::directory_iterator(path)) {
+            auto extension = entry.path().extension().string();
+            std::transform(begin(extension), end(extension), begin(extension),
+                           ::tolower);
+            if (fs::is_regular_file(entry.status()) && extension == ".sgf") {
+                files.emplace_back(entry.path().string());
+            }
+        }
+        std::sort(begin(files), end(files));
+        return files;
+    }
+
+    std::string json_string(const std::string& text) {
+        auto res = std::string{"\""};
+        for (const auto c : text) {
+            if (c == '"' || c == '\\') {
+                res += '\\';
+                res += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                res += str(boost::format("\\u%04x") % int(c));
+            } else {
+                res += c;
+            }
+        }
+        return res + "\"";
+    }
+}
+
+bool BatchAnalysis::run(Network& network, const std::string& path,
+                        const std::string& output, const int visits) {
+    auto games = std::vector<Game>{};
+    auto positions = std::vector<Position>{};
+    for (const auto& filename : find_sgf_files(path)) {
+        auto sgfs = std::vector<std::string>{};
+        try {
+            sgfs = SGFParser::chop_all(filename);
+        } catch (const std::exception&) {
+            myprintf("Cannot read %s.\n", filename.c_str());
+            continue;
+        }
+        for (auto i = size_t{0}; i < sgfs.size(); i++) {
+            auto tree = std::make_unique<SGFTree>();
+            try {
+                tree->load_from_string(sgfs[i]);
+            } catch (const std::exception&) {
+                myprintf("Skipping game %d of %s, it can't be parsed.\n",
+                         int(i), filename.c_str());
+                continue;
+            }
+            if (tree->get_state()->board.get_boardsize() != BOARD_SIZE) {
+                continue;
+            }
+            games.emplace_back(Game{filename, i, std::move(tree)});
+        }
+    }
+    // Positions point into games, which must not move any more.
+    for (const auto& game : games) {
+        const auto moves = game.tree->get_mainline().size();
+        for (auto movenum = size_t{0}; movenum <= moves; movenum++) {
+            positions.emplace_back(Position{&game, movenum});
+        }
+    }
+    if (positions.empty()) {
+        myprintf("No positions to analyze in %s.\n", path.c_str());
+        return false;
+    }
+
+    auto file = std::ofstream{};
+    if (!output.empty()) {
+        file.open(output);
+        if (!file) {
+            myprintf("Cannot write to %s.\n", output.c_str());
+            return false;
+        }
+    }
+    auto& out = output.empty() ? std::cout : file;
+
+    myprintf("Analyzing %d positions of %d games with %d visits each.\n",
+             int(positions.size()), int(games.size()), visits);
+    const auto start = Time{};
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex out_mutex;
+
+    ThreadGroup tg(thread_pool);
+    for (auto i = size_t{0}; i < thread_pool.size(); i++) {
+        tg.add_task([&]() {
+            GameState state;
+            UCTSearch search{state, network};
+            for (auto index = next++; index < positions.size();
+                 index = next++) {
+                const auto& position = positions[index];
+                state = position.game->tree->follow_mainline_state(
+                    position.movenum);
+                search.search_position(visits);
+
+                const auto line = str(
+                    boost::format("{\"file\":%s,\"game\":%d,\"movenum\":%d,"
+                                  "\"to_move\":\"%c\",\"analysis\":%s}")
+                    % json_string(position.game->filename)
+                    % position.game->index % position.movenum
+                    % (state.get_to_move() == FastBoard::BLACK ? 'B' : 'W')
+                    % search.get_analysis_json());
+                std::lock_guard<std::mutex> lock(out_mutex);
+                out << line << std::endl;
+                if (++done % 100 == 0) {
+                    myprintf("%d/%d positions, %.1f positions/s.\n",
+                             int(done), int(positions.size()),
+                             done / Time::timediff_seconds(start, Time{}));
+                }
+            }
+        });
+    }
+    tg.wait_all();
+
+    const auto elapsed = Time::timediff_seconds(start, Time{});
+    myprintf("Analyzed %d positions in %.1f s, %.1f positions/s.\n",
+             int(positions.size()), elapsed, positions.size() / elapsed);
+    return bool(out);
+}
@@ -0,0 +1,54 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BATCHANALYSIS_H_INCLUDED
+#define BATCHANALYSIS_H_INCLUDED
+
+#include "config.h"
+
+#include <string>
+
+class Network;
+
+// Reviews whole games: every position of the main line of every game in
+// an SGF file, or in all the SGF files of a directory, is searched with
+// the same number of visits. Each thread searches its own position, so
+// that the network sees as many evaluations at once as there are threads
+// without them sharing a tree. All searches use the same network and
+// cache.
+//
+// Writes one JSON object per position and line to output, or to stdout
+// if output is empty, in the order the searches finish. Returns false
+// if there was nothing to analyze, or the output can't be written.
+namespace BatchAnalysis {
+    bool run(Network& network, const std::string& path,
+             const std::string& output, int visits);
+}
+
+#endif
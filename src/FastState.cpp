@@ -177,5 +177,5 @@ int FastState::get_handicap() const {
 }
 
 std::uint64_t FastState::get_symmetry_hash(const int symmetry) const {
-    return board.calc_symmetry_hash(m_komove, symmetry);
+    return board.get_symmetry_hash(m_komove, symmetry);
 }
@@ -62,6 +62,16 @@ public:
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val) = 0;
+    // Evaluates several inputs.  Pipes that batch requests from
+    // different threads should queue them together.
+    virtual void forward_batch(
+        const std::vector<std::vector<float>>& inputs,
+        std::vector<std::vector<float>>& output_pol,
+        std::vector<std::vector<float>>& output_val) {
+        for (auto i = size_t{0}; i < inputs.size(); i++) {
+            forward(inputs[i], output_pol[i], output_val[i]);
+        }
+    }
     virtual void push_weights(
         unsigned int filter_size, unsigned int channels, unsigned int outputs,
         std::shared_ptr<const ForwardPipeWeights> weights) = 0;
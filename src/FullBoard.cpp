@@ -48,6 +48,7 @@ int FullBoard::remove_string(const int i) {
     do {
         m_hash    ^= Zobrist::zobrist[m_state[pos]][pos];
         m_ko_hash ^= Zobrist::zobrist[m_state[pos]][pos];
+        update_symmetry_hash(color, pos);
 
         m_state[pos] = EMPTY;
         m_parent[pos] = NUM_VERTICES;
@@ -121,6 +122,27 @@ std::uint64_t FullBoard::calc_symmetry_hash(const int komove,
     });
 }
 
+void FullBoard::update_symmetry_hash(const int color, const int vertex) {
+    const auto& keys = Zobrist::zobrist_sym[color][vertex];
+    for (auto s = 0; s < Zobrist::NUM_SYMMETRIES; s++) {
+        m_sym_hash[s] ^= keys[s];
+    }
+}
+
+std::uint64_t FullBoard::get_symmetry_hash(const int komove,
+                                           const int symmetry) const {
+    // m_hash also holds the symmetric terms (side to move, prisoners,
+    // passes), so only the stones and the ko point need replacing.
+    if (m_boardsize != BOARD_SIZE) {
+        return m_hash ^ calc_hash(komove)
+               ^ calc_symmetry_hash(komove, symmetry);
+    }
+    return m_hash
+           ^ m_sym_hash[Network::IDENTITY_SYMMETRY] ^ m_sym_hash[symmetry]
+           ^ Zobrist::zobrist_sym_ko[komove][Network::IDENTITY_SYMMETRY]
+           ^ Zobrist::zobrist_sym_ko[komove][symmetry];
+}
+
 std::uint64_t FullBoard::get_hash() const {
     return m_hash;
 }
@@ -144,6 +166,7 @@ int FullBoard::update_board(const int color, const int i) {
     m_ko_hash ^= Zobrist::zobrist[m_state[i]][i];
 
     m_state[i] = vertex_t(color);
+    update_symmetry_hash(color, i);
     m_next[i] = i;
     m_parent[i] = i;
     m_libs[i] = count_pliberties(i);
@@ -221,4 +244,5 @@ void FullBoard::reset_board(const int size) {
 
     m_hash = calc_hash();
     m_ko_hash = calc_ko_hash();
+    m_sym_hash.fill(0);
 }
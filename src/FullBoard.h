@@ -32,9 +32,11 @@
 
 #include "config.h"
 
+#include <array>
 #include <cstdint>
 
 #include "FastBoard.h"
+#include "Zobrist.h"
 
 class FullBoard : public FastBoard {
 public:
@@ -43,6 +45,9 @@ public:
 
     std::uint64_t get_hash() const;
     std::uint64_t get_ko_hash() const;
+    // Hash of the position transformed by a board symmetry, equal to
+    // get_hash() of that position. O(1) on a BOARD_SIZE board.
+    std::uint64_t get_symmetry_hash(int komove, int symmetry) const;
     void set_to_move(int tomove);
 
     void reset_board(int size);
@@ -54,8 +59,12 @@ public:
 
     std::uint64_t m_hash;
     std::uint64_t m_ko_hash;
+    // Stones under each symmetry, relative to the empty board.
+    std::array<std::uint64_t, Zobrist::NUM_SYMMETRIES> m_sym_hash;
 
 private:
+    void update_symmetry_hash(int color, int vertex);
+
     template <class Function>
     std::uint64_t calc_hash(int komove, Function transform) const;
 };
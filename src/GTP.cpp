@@ -40,6 +40,7 @@
 #include <limits>
 #include <memory>
 #include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -60,6 +61,10 @@ using namespace Utils;
 // Configuration flags
 bool cfg_gtp_mode;
 bool cfg_allow_pondering;
+int cfg_prefetch_replies;
+bool cfg_transpositions;
+unsigned int cfg_leaves;
+bool cfg_pin_threads;
 unsigned int cfg_num_threads;
 unsigned int cfg_batch_size;
 int cfg_max_playouts;
@@ -67,6 +72,7 @@ int cfg_max_visits;
 size_t cfg_max_memory;
 size_t cfg_max_tree_size;
 int cfg_max_cache_ratio_percent;
+size_t cfg_shared_cache_size;
 TimeManagement::enabled_t cfg_timemanage;
 int cfg_lagbuffer_cs;
 int cfg_resignpct;
@@ -74,6 +80,8 @@ int cfg_noise;
 int cfg_random_cnt;
 int cfg_random_min_visits;
 float cfg_random_temp;
+int cfg_fast_visits;
+float cfg_full_search_prob;
 std::uint64_t cfg_rng_seed;
 bool cfg_dumbpass;
 #ifdef USE_OPENCL
@@ -98,6 +106,13 @@ FILE* cfg_logfile_handle;
 bool cfg_quiet;
 std::string cfg_options_str;
 bool cfg_benchmark;
+std::string cfg_analyze_sgf;
+std::string cfg_analyze_output;
+int cfg_selfplay_games;
+std::string cfg_selfplay_output;
+bool cfg_binary_training;
+int cfg_training_compression;
+std::string cfg_training_spill;
 bool cfg_cpu_only;
 AnalyzeTags cfg_analyze_tags;
 
@@ -319,6 +334,10 @@ void GTP::initialize(std::unique_ptr<Network>&& net) {
 void GTP::setup_default_parameters() {
     cfg_gtp_mode = false;
     cfg_allow_pondering = true;
+    cfg_prefetch_replies = 0;
+    cfg_transpositions = false;
+    cfg_leaves = 1;
+    cfg_pin_threads = false;
 
     // we will re-calculate this on Leela.cpp
     cfg_num_threads = 1;
@@ -331,6 +350,7 @@ void GTP::setup_default_parameters() {
     // This will be overwriiten in initialize() after network size is known.
     cfg_max_tree_size = UCTSearch::DEFAULT_MAX_MEMORY;
     cfg_max_cache_ratio_percent = 10;
+    cfg_shared_cache_size = 0;
     cfg_timemanage = TimeManagement::AUTO;
     cfg_lagbuffer_cs = 100;
     cfg_weightsfile = leelaz_file("best-network");
@@ -357,10 +377,19 @@ void GTP::setup_default_parameters() {
     cfg_random_cnt = 0;
     cfg_random_min_visits = 1;
     cfg_random_temp = 1.0f;
+    cfg_fast_visits = 0;
+    cfg_full_search_prob = 0.25f;
     cfg_dumbpass = false;
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
     cfg_benchmark = false;
+    cfg_analyze_sgf.clear();
+    cfg_analyze_output.clear();
+    cfg_selfplay_games = 0;
+    cfg_selfplay_output = "selfplay";
+    cfg_binary_training = false;
+    cfg_training_compression = 9;
+    cfg_training_spill.clear();
 #ifdef USE_CPU_ONLY
     cfg_cpu_only = true;
 #else
@@ -414,6 +443,10 @@ const std::string GTP::s_commands[] = {
     "lz-analyze",
     "lz-genmove_analyze",
     "lz-memory_report",
+    "lz-cache_stats",
+    "lz-lock_profile",
+    "lz-save_tree",
+    "lz-load_tree",
     "lz-setoption",
     "gomill-explain_last_move",
     ""
@@ -681,6 +714,8 @@ void GTP::execute(GameState& game, const std::string& xinput) {
                 // Outputs winrate and pvs through gtp for lz-genmove_analyze
                 search->ponder();
             }
+        } else if (cfg_prefetch_replies && !game.has_resigned()) {
+            search->prefetch();
         }
         if (analysis_output) {
             // Terminate multi-line response
@@ -746,6 +781,8 @@ void GTP::execute(GameState& game, const std::string& xinput) {
                 if (!game.has_resigned()) {
                     search->ponder();
                 }
+            } else if (cfg_prefetch_replies && !game.has_resigned()) {
+                search->prefetch();
             }
         } else {
             gtp_fail_printf(id, "syntax not understood");
@@ -829,6 +866,8 @@ void GTP::execute(GameState& game, const std::string& xinput) {
                 if (!game.has_resigned()) {
                     search->ponder();
                 }
+            } else if (cfg_prefetch_replies && !game.has_resigned()) {
+                search->prefetch();
             }
         } else {
             gtp_fail_printf(id, "syntax not understood");
@@ -1191,6 +1230,82 @@ void GTP::execute(GameState& game, const std::string& xinput) {
                    total / MiB, base_memory / MiB, tree_size / MiB,
                    cache_size / MiB);
         return;
+    } else if (command.find("lz-cache_stats") == 0) {
+        // One "key value..." pair per line, histograms as a list of
+        // buckets. See NNCache::BasicStats for the bucketing.
+        const auto stats = s_network->nncache_stats();
+        auto out = std::ostringstream{};
+        auto histogram = [&out](const char* name, const auto& buckets) {
+            out << name;
+            for (const auto count : buckets) {
+                out << ' ' << count;
+            }
+            out << '\n';
+        };
+        out << "size " << stats.size << '\n'
+            << "capacity " << stats.capacity << '\n'
+            << "lookups " << stats.lookups << '\n'
+            << "hits " << stats.hits << '\n'
+            << "symmetry_lookups " << stats.symmetry_lookups << '\n'
+            << "symmetry_hits " << stats.symmetry_hits << '\n'
+            << "shared_hits " << stats.shared_hits << '\n'
+            << "inserts " << stats.inserts << '\n'
+            << "duplicates " << stats.duplicates << '\n'
+            << "move_bucket_size " << stats.MOVE_BUCKET_SIZE << '\n';
+        histogram("move_lookups", stats.move_lookups);
+        histogram("move_hits", stats.move_hits);
+        histogram("depth_lookups", stats.depth_lookups);
+        histogram("depth_hits", stats.depth_hits);
+        histogram("age_hits", stats.age_hits);
+        auto text = out.str();
+        text.pop_back();
+        gtp_printf(id, "%s", text.c_str());
+        return;
+    } else if (command.find("lz-lock_profile") == 0) {
+        // "on", "off" and "reset" control the profiler, without an
+        // argument it reports one lock site per line.
+        std::istringstream cmdstream(command);
+        std::string tmp, action;
+        cmdstream >> tmp >> action;
+        if (action == "on" || action == "off") {
+            SMP::set_lock_profiling(action == "on");
+            gtp_printf(id, "");
+        } else if (action == "reset") {
+            SMP::reset_lock_profile();
+            gtp_printf(id, "");
+        } else if (action.empty()) {
+            auto out = std::ostringstream{};
+            out << "profiling " << (SMP::lock_profiling() ? "on" : "off");
+            for (const auto& site : SMP::get_lock_profile()) {
+                out << '\n' << site.site
+                    << " acquires " << site.acquires
+                    << " contended " << site.contended
+                    << " spins " << site.spins
+                    << " wait_ms " << site.wait_ms;
+            }
+            gtp_printf(id, "%s", out.str().c_str());
+        } else {
+            gtp_fail_printf(id, "syntax not understood");
+        }
+        return;
+    } else if (command.find("lz-save_tree") == 0
+               || command.find("lz-load_tree") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        // tmp will eat the command name
+        cmdstream >> tmp >> filename;
+
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+        } else if (tmp == "lz-save_tree" && !search->save_tree(filename)) {
+            gtp_fail_printf(id, "cannot write tree to %s", filename.c_str());
+        } else if (tmp == "lz-load_tree" && !search->load_tree(filename)) {
+            gtp_fail_printf(id, "cannot load tree from %s", filename.c_str());
+        } else {
+            gtp_printf(id, "");
+        }
+        return;
     } else if (command.find("lz-setoption") == 0) {
         return execute_setoption(*search.get(), id, command);
     } else if (command.find("gomill-explain_last_move") == 0) {
@@ -80,6 +80,10 @@ private:
 
 extern bool cfg_gtp_mode;
 extern bool cfg_allow_pondering;
+extern int cfg_prefetch_replies;
+extern bool cfg_transpositions;
+extern unsigned int cfg_leaves;
+extern bool cfg_pin_threads;
 extern unsigned int cfg_num_threads;
 extern unsigned int cfg_batch_size;
 extern int cfg_max_playouts;
@@ -87,6 +91,7 @@ extern int cfg_max_visits;
 extern size_t cfg_max_memory;
 extern size_t cfg_max_tree_size;
 extern int cfg_max_cache_ratio_percent;
+extern size_t cfg_shared_cache_size;
 extern TimeManagement::enabled_t cfg_timemanage;
 extern int cfg_lagbuffer_cs;
 extern int cfg_resignpct;
@@ -94,6 +99,8 @@ extern int cfg_noise;
 extern int cfg_random_cnt;
 extern int cfg_random_min_visits;
 extern float cfg_random_temp;
+extern int cfg_fast_visits;
+extern float cfg_full_search_prob;
 extern std::uint64_t cfg_rng_seed;
 extern bool cfg_dumbpass;
 #ifdef USE_OPENCL
@@ -121,6 +128,13 @@ extern FILE* cfg_logfile_handle;
 extern bool cfg_quiet;
 extern std::string cfg_options_str;
 extern bool cfg_benchmark;
+extern std::string cfg_analyze_sgf;
+extern std::string cfg_analyze_output;
+extern int cfg_selfplay_games;
+extern std::string cfg_selfplay_output;
+extern bool cfg_binary_training;
+extern int cfg_training_compression;
+extern std::string cfg_training_spill;
 extern bool cfg_cpu_only;
 extern AnalyzeTags cfg_analyze_tags;
 
@@ -74,3 +74,12 @@ void KoState::play_move(const int color, const int vertex) {
     }
     m_ko_hash_history.push_back(board.get_ko_hash());
 }
+
+void KoState::reserve_ko_hash_history(const size_t size) {
+    m_ko_hash_history.reserve(size);
+}
+
+void KoState::pop_ko_hash() {
+    assert(m_ko_hash_history.size() > 1);
+    m_ko_hash_history.pop_back();
+}
@@ -46,6 +46,11 @@ public:
     void play_move(int color, int vertex);
     void play_move(int vertex);
 
+protected:
+    void reserve_ko_hash_history(size_t size);
+    // Take back the ko hash of the last move.
+    void pop_ko_hash();
+
 private:
     std::vector<std::uint64_t> m_ko_hash_history;
 };
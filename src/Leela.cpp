@@ -41,11 +41,13 @@
 #include <string>
 #include <vector>
 
+#include "BatchAnalysis.h"
 #include "GTP.h"
 #include "GameState.h"
 #include "NNCache.h"
 #include "Network.h"
 #include "Random.h"
+#include "SelfPlay.h"
 #include "ThreadPool.h"
 #include "Utils.h"
 #include "Zobrist.h"
@@ -87,6 +89,8 @@ static void calculate_thread_count_gpu(
     // 1) if no args are given, use batch size of 5 and thread count of (batch size) * (number of gpus) * 2
     // 2) if number of threads are given, use batch size of (thread count) / (number of gpus) / 2
     // 3) if number of batches are given, use thread count of (batch size) * (number of gpus) * 2
+    // Thread counts are divided by --leaves, since each thread then fills
+    // that many batch slots.
     auto gpu_count = cfg_gpus.size();
     if (gpu_count == 0) {
         // size of zero if autodetect GPU : default to 1
@@ -104,8 +108,8 @@ static void calculate_thread_count_gpu(
         if (vm["batchsize"].as<unsigned int>() > 0) {
             cfg_batch_size = vm["batchsize"].as<unsigned int>();
         } else {
-            cfg_batch_size =
-                (cfg_num_threads + (gpu_count * 2) - 1) / (gpu_count * 2);
+            cfg_batch_size = (cfg_num_threads * cfg_leaves + (gpu_count * 2) - 1)
+                             / (gpu_count * 2);
 
             // no idea why somebody wants to use threads less than the number of GPUs
             // but should at least prevent crashing
@@ -120,14 +124,16 @@ static void calculate_thread_count_gpu(
             cfg_batch_size = 5;
         }
 
-        cfg_num_threads =
-            std::min(cfg_max_threads, cfg_batch_size * gpu_count * 2);
+        cfg_num_threads = std::min(
+            cfg_max_threads,
+            (cfg_batch_size * gpu_count * 2 + cfg_leaves - 1) / cfg_leaves);
     }
 
-    if (cfg_num_threads < cfg_batch_size) {
+    if (cfg_num_threads * cfg_leaves < cfg_batch_size) {
         printf(
-            "Number of threads = %d must be no smaller than batch size = %d\n",
-            cfg_num_threads, cfg_batch_size);
+            "Number of threads = %d times leaves = %d must be no smaller "
+            "than batch size = %d\n",
+            cfg_num_threads, cfg_leaves, cfg_batch_size);
         exit(EXIT_FAILURE);
     }
 }
@@ -164,9 +170,45 @@ static void parse_commandline(const int argc, const char* const argv[]) {
                        ", but use full time if moving faster doesn't save time.\n"
                        "fast = Same as on but always plays faster.\n"
                        "no_pruning = For self play training use.\n")
+        ("shared-cache", po::value<int>(),
+                         "Share an NN cache of x MiB with other processes "
+                         "using the same network on this host.")
         ("noponder", "Disable thinking on opponent's time.")
+        ("prefetch", po::value<int>(),
+                     "With --noponder, evaluate the x most likely replies "
+                     "and x answers to each while waiting for the opponent.")
+        ("pin-threads", "Pin each search thread to its own CPU core.")
+        ("transpositions", "Share search statistics between transposed "
+                           "positions.")
+        ("leaves", po::value<unsigned int>()->default_value(cfg_leaves),
+                   "Number of leaves each thread gathers before submitting "
+                   "them to the network as one batch.")
         ("benchmark", "Test network and exit. Default args:\n-v3200 --noponder "
                       "-m0 -t1 -s1.")
+        ("analyze-sgf", po::value<std::string>(),
+                        "Analyze every position of an SGF file, or of all "
+                        "the SGF files in a directory, and exit. Each thread "
+                        "searches its own position. Default args:\n-v1600 "
+                        "--noponder")
+        ("analyze-output", po::value<std::string>(),
+                           "Write the analysis as JSON lines to this file "
+                           "instead of stdout.")
+        ("selfplay", po::value<int>(),
+                     "Play x games against itself, as many at once as there "
+                     "are threads, and exit. Default args:\n-v1600 "
+                     "--noponder -q")
+        ("selfplay-output", po::value<std::string>(),
+                            "Basename of the training chunks and the SGF "
+                            "file written by --selfplay.")
+        ("binary-training", "Write training chunks in the binary v2 format "
+                            "instead of text.")
+        ("training-compression",
+         po::value<int>()->default_value(cfg_training_compression),
+         "gzip level of training chunks, 0-9.")
+        ("training-spill", po::value<std::string>(),
+                           "Write the training data of the current game to "
+                           "a file in this directory as it is recorded, "
+                           "instead of keeping it in memory.")
 #ifndef USE_CPU_ONLY
         ("cpu-only", "Use CPU-only implementation and do not use OpenCL device(s).")
 #endif
@@ -198,7 +240,13 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         ("randomvisits", po::value<int>()->default_value(cfg_random_min_visits),
                          "Don't play random moves if they have <= x visits.")
         ("randomtemp", po::value<float>()->default_value(cfg_random_temp),
-                       "Temperature to use for random move selection.");
+                       "Temperature to use for random move selection.")
+        ("fastvisits", po::value<int>()->default_value(cfg_fast_visits),
+                       "Search most moves with only x visits, and leave "
+                       "them out of the policy training data. 0 = off.")
+        ("fullsearchprob",
+         po::value<float>()->default_value(cfg_full_search_prob),
+         "Chance of a full search for a move with --fastvisits.");
 #ifdef USE_TUNER
     po::options_description tuner_desc("Tuning options");
     tuner_desc.add_options()
@@ -363,6 +411,12 @@ static void parse_commandline(const int argc, const char* const argv[]) {
     cfg_cpu_only = true;
 #endif
 
+    cfg_leaves = vm["leaves"].as<unsigned int>();
+    if (cfg_leaves == 0) {
+        printf("Invalid leaves count.\n");
+        exit(EXIT_FAILURE);
+    }
+
     if (cfg_cpu_only) {
         calculate_thread_count_cpu(vm);
     } else {
@@ -386,6 +440,22 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         cfg_allow_pondering = false;
     }
 
+    if (vm.count("pin-threads")) {
+        cfg_pin_threads = true;
+    }
+
+    if (vm.count("transpositions")) {
+        cfg_transpositions = true;
+    }
+
+    if (vm.count("prefetch")) {
+        cfg_prefetch_replies = vm["prefetch"].as<int>();
+        if (cfg_prefetch_replies < 0) {
+            printf("Invalid prefetch count.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (vm.count("noise")) {
         cfg_noise = true;
     }
@@ -418,6 +488,15 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         }
     }
 
+    if (vm.count("shared-cache")) {
+        auto shared_cache_mib = vm["shared-cache"].as<int>();
+        if (shared_cache_mib < 0) {
+            printf("Invalid shared cache size.\n");
+            exit(EXIT_FAILURE);
+        }
+        cfg_shared_cache_size = size_t(shared_cache_mib) * MiB;
+    }
+
     if (vm.count("resignpct")) {
         cfg_resignpct = vm["resignpct"].as<int>();
     }
@@ -434,6 +513,22 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         cfg_random_temp = vm["randomtemp"].as<float>();
     }
 
+    if (vm.count("fastvisits")) {
+        cfg_fast_visits = vm["fastvisits"].as<int>();
+        if (cfg_fast_visits < 0) {
+            printf("Invalid fast search visits.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("fullsearchprob")) {
+        cfg_full_search_prob = vm["fullsearchprob"].as<float>();
+        if (cfg_full_search_prob < 0.0f || cfg_full_search_prob > 1.0f) {
+            printf("Full search probability must be between 0 and 1.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (vm.count("timemanage")) {
         auto tm = vm["timemanage"].as<std::string>();
         if (tm == "auto") {
@@ -478,6 +573,59 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         }
     }
 
+    if (vm.count("analyze-sgf")) {
+        cfg_analyze_sgf = vm["analyze-sgf"].as<std::string>();
+        cfg_allow_pondering = false;
+        if (!vm.count("visits")) {
+            cfg_max_visits = 1600;
+        }
+        if (cfg_max_visits == UCTSearch::UNLIMITED_PLAYOUTS) {
+            printf("Batch analysis needs a visit limit.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (vm.count("analyze-output")) {
+            cfg_analyze_output = vm["analyze-output"].as<std::string>();
+        }
+    }
+
+    if (vm.count("selfplay")) {
+        cfg_selfplay_games = vm["selfplay"].as<int>();
+        if (cfg_selfplay_games <= 0) {
+            printf("Invalid number of self-play games.\n");
+            exit(EXIT_FAILURE);
+        }
+        // The searches of several games would be interleaved.
+        cfg_quiet = true;
+        cfg_allow_pondering = false;
+        if (!vm.count("playouts") && !vm.count("visits")) {
+            cfg_max_visits = 1600;
+        }
+        if (vm.count("selfplay-output")) {
+            cfg_selfplay_output = vm["selfplay-output"].as<std::string>();
+        }
+    }
+
+    if (vm.count("binary-training")) {
+        cfg_binary_training = true;
+    }
+
+    if (vm.count("training-compression")) {
+        cfg_training_compression = vm["training-compression"].as<int>();
+        if (cfg_training_compression < 0 || cfg_training_compression > 9) {
+            printf("Training compression level must be between 0 and 9.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("training-spill")) {
+        cfg_training_spill = vm["training-spill"].as<std::string>();
+        if (!boost::filesystem::is_directory(cfg_training_spill)) {
+            printf("Training spill directory %s doesn't exist.\n",
+                   cfg_training_spill.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Do not lower the expected eval for root moves that are likely not
     // the best if we have introduced noise there exactly to explore more.
     cfg_fpu_root_reduction = cfg_noise ? 0.0f : cfg_fpu_reduction;
@@ -502,7 +650,7 @@ static void initialize_network() {
 
 // Setup global objects after command line has been parsed
 void init_global_objects() {
-    thread_pool.initialize(cfg_num_threads);
+    thread_pool.initialize(cfg_num_threads, cfg_pin_threads);
 
     // Use deterministic random numbers for hashing
     auto rng = std::make_unique<Random>(5489);
@@ -545,7 +693,8 @@ int main(int argc, char* argv[]) {
     setbuf(stdin, nullptr);
 #endif
 
-    if (!cfg_gtp_mode && !cfg_benchmark) {
+    if (!cfg_gtp_mode && !cfg_benchmark && cfg_analyze_sgf.empty()
+        && !cfg_selfplay_games) {
         license_blurb();
     }
 
@@ -562,6 +711,18 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    if (!cfg_analyze_sgf.empty()) {
+        const auto ok = BatchAnalysis::run(*GTP::s_network, cfg_analyze_sgf,
+                                           cfg_analyze_output, cfg_max_visits);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (cfg_selfplay_games) {
+        SelfPlay::run(*GTP::s_network, cfg_selfplay_games,
+                      cfg_selfplay_output);
+        return 0;
+    }
+
     for (;;) {
         if (!cfg_gtp_mode) {
             maingame->display_state();
@@ -29,12 +29,14 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 
 #include "NNCache.h"
 
 #include "GTP.h"
+#include "SharedNNCache.h"
 #include "UCTSearch.h"
 #include "Utils.h"
 
@@ -42,40 +44,118 @@ const int NNCache::MAX_CACHE_COUNT;
 const int NNCache::MIN_CACHE_COUNT;
 const size_t NNCache::ENTRY_SIZE;
 
-NNCache::NNCache(const int size) : m_size(size) {}
+NNCache::NNCache(const int size)
+    : m_size(size), m_stats(new StatsShard[STATS_SHARDS]()) {}
 
-bool NNCache::lookup(const std::uint64_t hash, Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    ++m_lookups;
+NNCache::~NNCache() = default;
 
-    auto iter = m_cache.find(hash);
-    if (iter == m_cache.end()) {
-        return false; // Not found.
-    }
+bool NNCache::attach_shared(const std::uint64_t net_hash, const size_t size) {
+    m_shared = SharedNNCache::attach(net_hash, size);
+    return m_shared != nullptr;
+}
 
-    const auto& entry = iter->second;
+NNCache::StatsShard& NNCache::thread_stats() {
+    static std::atomic<size_t> s_next_shard{0};
+    thread_local auto shard = s_next_shard++ % STATS_SHARDS;
+    return m_stats[shard];
+}
 
-    // Found it.
-    ++m_hits;
-    result = entry->result;
-    return true;
+template <typename T>
+static void count(T& counter) {
+    counter.fetch_add(1, std::memory_order_relaxed);
 }
 
-void NNCache::insert(const std::uint64_t hash, const Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+template <typename T, size_t N>
+static T& bucket(std::array<T, N>& histogram, const int index) {
+    return histogram[std::min(size_t(std::max(index, 0)), N - 1)];
+}
 
-    if (m_cache.find(hash) != m_cache.end()) {
-        return; // Already in the cache.
+bool NNCache::lookup(const std::uint64_t hash, Netresult& result,
+                     const int movenum, const int depth,
+                     const bool symmetry) {
+    auto& stats = thread_stats();
+    const auto move_bucket = movenum / Stats::MOVE_BUCKET_SIZE;
+    if (symmetry) {
+        count(stats.symmetry_lookups);
+    } else {
+        count(stats.lookups);
+        if (movenum >= 0) {
+            count(bucket(stats.move_lookups, move_bucket));
+        }
+        if (depth >= 0) {
+            count(bucket(stats.depth_lookups, depth));
+        }
+    }
+    auto count_hit = [&]() {
+        if (symmetry) {
+            count(stats.symmetry_hits);
+            return;
+        }
+        count(stats.hits);
+        if (movenum >= 0) {
+            count(bucket(stats.move_hits, move_bucket));
+        }
+        if (depth >= 0) {
+            count(bucket(stats.depth_hits, depth));
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_lookups;
+
+        auto iter = m_cache.find(hash);
+        if (iter != m_cache.end()) {
+            // Found it.
+            ++m_hits;
+            result = iter->second->result;
+            auto age = m_inserts - iter->second->inserted;
+            auto age_bucket = 0;
+            while (age >>= 1) {
+                age_bucket++;
+            }
+            count(bucket(stats.age_hits, age_bucket));
+            count_hit();
+            return true;
+        }
     }
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
-    m_order.push_back(hash);
-    ++m_inserts;
+    // The shared segment is lock-free, no need to hold our mutex.
+    if (m_shared && m_shared->lookup(hash, result)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_hits;
+        ++m_shared_hits;
+        count(stats.shared_hits);
+        count_hit();
+        return true;
+    }
 
-    // If the cache is too large, remove the oldest entry.
-    if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    return false; // Not found.
+}
+
+void NNCache::insert(const std::uint64_t hash, const Netresult& result) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_cache.find(hash) != m_cache.end()) {
+            count(thread_stats().duplicates);
+            return; // Already in the cache.
+        }
+
+        m_cache.emplace(hash, std::make_unique<Entry>(result, m_inserts));
+        m_order.push_back(hash);
+        ++m_inserts;
+        count(thread_stats().inserts);
+
+        // If the cache is too large, remove the oldest entry.
+        if (m_order.size() > m_size) {
+            m_cache.erase(m_order.front());
+            m_order.pop_front();
+        }
+    }
+
+    if (m_shared) {
+        m_shared->insert(hash, result);
     }
 }
 
@@ -88,6 +168,8 @@ void NNCache::resize(const int size) {
 }
 
 void NNCache::clear() {
+    // The shared segment belongs to all attached processes,
+    // so only our own entries are dropped.
     m_cache.clear();
     m_order.clear();
 }
@@ -106,9 +188,44 @@ void NNCache::set_size_from_playouts(const int max_playouts) {
 
 void NNCache::dump_stats() {
     Utils::myprintf(
-        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %u size\n",
+        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %zu inserts, %zu size\n",
         m_hits, m_lookups, 100. * m_hits / (m_lookups + 1), m_inserts,
         m_cache.size());
+    if (m_shared) {
+        Utils::myprintf("NNCache: %d hits from shared cache, %d processes\n",
+                        m_shared_hits, m_shared->get_attached());
+    }
+}
+
+NNCache::Stats NNCache::get_stats() {
+    auto stats = Stats{};
+    auto sum = [](auto& total, const auto& shard) {
+        for (auto i = size_t{0}; i < total.size(); i++) {
+            total[i] += shard[i].load(std::memory_order_relaxed);
+        }
+    };
+    for (auto i = size_t{0}; i < STATS_SHARDS; i++) {
+        const auto& shard = m_stats[i];
+        sum(stats.move_lookups, shard.move_lookups);
+        sum(stats.move_hits, shard.move_hits);
+        sum(stats.depth_lookups, shard.depth_lookups);
+        sum(stats.depth_hits, shard.depth_hits);
+        sum(stats.age_hits, shard.age_hits);
+        stats.lookups += shard.lookups.load(std::memory_order_relaxed);
+        stats.hits += shard.hits.load(std::memory_order_relaxed);
+        stats.symmetry_lookups +=
+            shard.symmetry_lookups.load(std::memory_order_relaxed);
+        stats.symmetry_hits +=
+            shard.symmetry_hits.load(std::memory_order_relaxed);
+        stats.shared_hits += shard.shared_hits.load(std::memory_order_relaxed);
+        stats.inserts += shard.inserts.load(std::memory_order_relaxed);
+        stats.duplicates += shard.duplicates.load(std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats.size = m_cache.size();
+    stats.capacity = m_size;
+    return stats;
 }
 
 size_t NNCache::get_estimated_size() {
@@ -33,11 +33,15 @@
 #include "config.h"
 
 #include <array>
+#include <atomic>
+#include <cstdint>
 #include <deque>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
 
+class SharedNNCache;
+
 class NNCache {
 public:
     // Maximum size of the cache in number of items.
@@ -61,11 +65,43 @@ public:
         }
     };
 
+    // Cache statistics, to help sizing the cache. Move numbers are
+    // bucketed by MOVE_BUCKET_SIZE, depths below the search root are
+    // exact, and the age of an entry at hit time (inserts since it was
+    // added) is bucketed by powers of two. The last bucket of each
+    // histogram also counts everything beyond it.
+    template <typename T>
+    struct BasicStats {
+        static constexpr int MOVE_BUCKET_SIZE = 25;
+        static constexpr int MOVE_BUCKETS = 16;
+        static constexpr int DEPTH_BUCKETS = 32;
+        static constexpr int AGE_BUCKETS = 24;
+
+        std::array<T, MOVE_BUCKETS> move_lookups{};
+        std::array<T, MOVE_BUCKETS> move_hits{};
+        std::array<T, DEPTH_BUCKETS> depth_lookups{};
+        std::array<T, DEPTH_BUCKETS> depth_hits{};
+        std::array<T, AGE_BUCKETS> age_hits{};
+        T lookups{0};
+        T hits{0};
+        T symmetry_lookups{0};
+        T symmetry_hits{0};
+        T shared_hits{0};
+        T inserts{0};
+        T duplicates{0};
+    };
+
+    struct Stats : BasicStats<std::uint64_t> {
+        size_t size{0};
+        size_t capacity{0};
+    };
+
     static constexpr size_t ENTRY_SIZE = sizeof(Netresult)
                                          + sizeof(std::uint64_t)
                                          + sizeof(std::unique_ptr<Netresult>);
 
     NNCache(int size = MAX_CACHE_COUNT); // ~ 208MiB
+    ~NNCache();
 
     // Set a reasonable size gives max number of playouts
     void set_size_from_playouts(int max_playouts);
@@ -74,8 +110,17 @@ public:
     void resize(int size);
     void clear();
 
-    // Try and find an existing entry.
-    bool lookup(std::uint64_t hash, Netresult& result);
+    // Back this cache with a segment shared between all processes
+    // running the same network. Returns false if that isn't possible.
+    bool attach_shared(std::uint64_t net_hash, size_t size);
+
+    // Try and find an existing entry. movenum is the move number of the
+    // position and depth its depth below the search root (-1 if unknown),
+    // symmetry is set when probing with the hash of a transformed
+    // position. Symmetry probes are only counted as symmetry lookups and
+    // hits.
+    bool lookup(std::uint64_t hash, Netresult& result, int movenum = -1,
+                int depth = -1, bool symmetry = false);
 
     // Insert a new entry.
     void insert(std::uint64_t hash, const Netresult& result);
@@ -87,6 +132,9 @@ public:
 
     void dump_stats();
 
+    // Sum the statistics over all threads.
+    Stats get_stats();
+
     // Return the estimated memory consumption of the cache.
     size_t get_estimated_size();
 
@@ -98,11 +146,26 @@ private:
     // Statistics
     int m_hits{0};
     int m_lookups{0};
-    int m_inserts{0};
+    size_t m_inserts{0};
+    int m_shared_hits{0};
+
+    // Detailed statistics are kept per thread so that the search
+    // threads never contend on them.
+    static constexpr size_t STATS_SHARDS = 64;
+    struct StatsShard : BasicStats<std::atomic<std::uint64_t>> {
+        // Keep shards of different threads off the same cache line.
+        char padding[64];
+    };
+    StatsShard& thread_stats();
+    std::unique_ptr<StatsShard[]> m_stats;
+
+    // Optional second level, shared with other processes.
+    std::unique_ptr<SharedNNCache> m_shared;
 
     struct Entry {
-        Entry(const Netresult& r) : result(r) {}
+        Entry(const Netresult& r, size_t seq) : result(r), inserted(seq) {}
         Netresult result; // ~ 1.4KiB
+        size_t inserted;  // m_inserts when added
     };
 
     // Map from hash to {features, result}
@@ -36,6 +36,7 @@
 #include <boost/utility.hpp>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <iterator>
 #include <memory>
 #include <sstream>
@@ -65,6 +66,7 @@
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "SearchState.h"
 #include "NNCache.h"
 #include "Random.h"
 #include "ThreadPool.h"
@@ -90,6 +92,16 @@ using ConstEigenMatrixMap =
 static std::array<std::array<int, NUM_INTERSECTIONS>, Network::NUM_SYMMETRIES>
     symmetry_nn_idx_table;
 
+// Depth below the search root for the cache statistics, only known
+// during playouts.
+static int root_depth(const GameState* const) {
+    return -1;
+}
+
+static int root_depth(const SearchState* const state) {
+    return static_cast<int>(state->get_root_depth());
+}
+
 float Network::benchmark_time(const int centiseconds) {
     const auto cpus = cfg_num_threads;
 
@@ -379,6 +391,22 @@ std::pair<int, int> Network::load_network_file(const std::string& filename) {
     }
     gzclose(gzhandle);
 
+    // Identify the network by its contents, so that processes sharing
+    // an NN cache only share results computed by the same weights.
+    // FNV-1a, with the softmax temperature mixed in as it changes the
+    // policy output.
+    {
+        const auto contents = buffer.str();
+        auto hash = std::uint64_t{0xCBF29CE484222325};
+        for (const auto c : contents) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001B3;
+        }
+        std::uint32_t temp_bits;
+        std::memcpy(&temp_bits, &cfg_softmax_temp, sizeof(temp_bits));
+        m_network_hash = hash ^ temp_bits;
+    }
+
     // Read format version
     auto line = std::string{};
     auto format_version = -1;
@@ -537,6 +565,12 @@ void Network::initialize(const int playouts, const std::string& weightsfile) {
         exit(EXIT_FAILURE);
     }
 
+    if (cfg_shared_cache_size > 0) {
+        if (!m_nncache.attach_shared(m_network_hash, cfg_shared_cache_size)) {
+            myprintf("Continuing with a private NN cache only.\n");
+        }
+    }
+
     auto weight_index = size_t{0};
     // Input convolution
     // Winograd transform convolution weights
@@ -711,9 +745,12 @@ std::vector<float> softmax(const std::vector<float>& input,
     return output;
 }
 
-bool Network::probe_cache(const GameState* const state,
+template <typename State>
+bool Network::probe_cache(const State* const state,
                           Network::Netresult& result) {
-    if (m_nncache.lookup(state->board.get_hash(), result)) {
+    const auto movenum = static_cast<int>(state->get_movenum());
+    const auto depth = root_depth(state);
+    if (m_nncache.lookup(state->board.get_hash(), result, movenum, depth)) {
         return true;
     }
     // If we are not generating a self-play game, try to find
@@ -726,7 +763,7 @@ bool Network::probe_cache(const GameState* const state,
                 continue;
             }
             const auto hash = state->get_symmetry_hash(sym);
-            if (m_nncache.lookup(hash, result)) {
+            if (m_nncache.lookup(hash, result, movenum, depth, true)) {
                 decltype(result.policy) corrected_policy;
                 for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; ++idx) {
                     const auto sym_idx = symmetry_nn_idx_table[sym][idx];
@@ -744,18 +781,26 @@ bool Network::probe_cache(const GameState* const state,
 Network::Netresult Network::get_output(
     const GameState* const state, const Ensemble ensemble, const int symmetry,
     const bool read_cache, const bool write_cache, const bool force_selfcheck) {
+    return get_output_impl(state, ensemble, symmetry, read_cache, write_cache,
+                           force_selfcheck);
+}
+
+Network::Netresult Network::get_output(
+    const SearchState* const state, const Ensemble ensemble, const int symmetry,
+    const bool read_cache, const bool write_cache, const bool force_selfcheck) {
+    return get_output_impl(state, ensemble, symmetry, read_cache, write_cache,
+                           force_selfcheck);
+}
+
+template <typename State>
+Network::Netresult Network::get_output_impl(
+    const State* const state, const Ensemble ensemble, const int symmetry,
+    const bool read_cache, const bool write_cache, const bool force_selfcheck) {
     Netresult result;
-    if (state->board.get_boardsize() != BOARD_SIZE) {
+    if (lookup_output(state, result, read_cache)) {
         return result;
     }
 
-    if (read_cache) {
-        // See if we already have this in the cache.
-        if (probe_cache(state, result)) {
-            return result;
-        }
-    }
-
     if (ensemble == DIRECT) {
         assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
         result = get_output_internal(state, symmetry);
@@ -778,22 +823,50 @@ Network::Netresult Network::get_output(
         assert(symmetry == -1);
         const auto rand_sym = Random::get_Rng().randfix<NUM_SYMMETRIES>();
         result = get_output_internal(state, rand_sym);
+        selfcheck_output(state, result, rand_sym, force_selfcheck);
+    }
+
+    store_output(state, result, write_cache);
+    return result;
+}
+
+template <typename State>
+bool Network::lookup_output(const State* const state, Netresult& result,
+                            const bool read_cache) {
+    // Positions on other board sizes are not evaluated.
+    if (state->board.get_boardsize() != BOARD_SIZE) {
+        return true;
+    }
+    // See if we already have this in the cache.
+    return read_cache && probe_cache(state, result);
+}
+
+template <typename State>
+void Network::selfcheck_output(const State* const state,
+                               const Netresult& result, const int symmetry,
+                               const bool force_selfcheck) {
 #ifdef USE_OPENCL_SELFCHECK
-        // Both implementations are available, self-check the OpenCL driver by
-        // running both with a probability of 1/2000.
-        // selfcheck is done here because this is the only place NN
-        // evaluation is done on actual gameplay.
-        if (m_forward_cpu != nullptr
-            && (force_selfcheck
-                || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)) {
-            auto result_ref = get_output_internal(state, rand_sym, true);
-            compare_net_outputs(result, result_ref);
-        }
+    // Both implementations are available, self-check the OpenCL driver by
+    // running both with a probability of 1/2000.
+    // selfcheck is done here because this is the only place NN
+    // evaluation is done on actual gameplay.
+    if (m_forward_cpu != nullptr
+        && (force_selfcheck
+            || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)) {
+        auto result_ref = get_output_internal(state, symmetry, true);
+        compare_net_outputs(result, result_ref);
+    }
 #else
-        (void)force_selfcheck;
+    (void)state;
+    (void)result;
+    (void)symmetry;
+    (void)force_selfcheck;
 #endif
-    }
+}
 
+template <typename State>
+void Network::store_output(const State* const state, Netresult& result,
+                           const bool write_cache) {
     // v2 format (ELF Open Go) returns black value, not stm
     if (m_value_head_not_stm) {
         if (state->board.get_to_move() == FastBoard::WHITE) {
@@ -805,18 +878,54 @@ Network::Netresult Network::get_output(
         // Insert result into cache.
         m_nncache.insert(state->board.get_hash(), result);
     }
+}
 
-    return result;
+std::vector<Network::Netresult> Network::get_output_batch(
+    const std::vector<const SearchState*>& states) {
+    auto results = std::vector<Netresult>(states.size());
+    auto misses = std::vector<size_t>{};
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        if (!lookup_output(states[i], results[i], true)) {
+            misses.emplace_back(i);
+        }
+    }
+    if (misses.empty()) {
+        return results;
+    }
+
+    auto symmetries = std::vector<int>{};
+    auto input_data = std::vector<std::vector<float>>{};
+    for (const auto i : misses) {
+        const auto rand_sym = Random::get_Rng().randfix<NUM_SYMMETRIES>();
+        symmetries.emplace_back(rand_sym);
+        input_data.emplace_back(gather_features_impl(states[i], rand_sym));
+    }
+    auto policy_data = std::vector<std::vector<float>>(
+        misses.size(), std::vector<float>(OUTPUTS_POLICY * NUM_INTERSECTIONS));
+    auto value_data = std::vector<std::vector<float>>(
+        misses.size(), std::vector<float>(OUTPUTS_VALUE * NUM_INTERSECTIONS));
+    m_forward->forward_batch(input_data, policy_data, value_data);
+
+    for (auto j = size_t{0}; j < misses.size(); j++) {
+        const auto state = states[misses[j]];
+        auto& result = results[misses[j]];
+        result = process_output(policy_data[j], value_data[j], symmetries[j]);
+        selfcheck_output(state, result, symmetries[j], false);
+        store_output(state, result, true);
+    }
+
+    return results;
 }
 
-Network::Netresult Network::get_output_internal(const GameState* const state,
+template <typename State>
+Network::Netresult Network::get_output_internal(const State* const state,
                                                 const int symmetry,
                                                 bool selfcheck) {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
     constexpr auto width = BOARD_SIZE;
     constexpr auto height = BOARD_SIZE;
 
-    const auto input_data = gather_features(state, symmetry);
+    const auto input_data = gather_features_impl(state, symmetry);
     std::vector<float> policy_data(OUTPUTS_POLICY * width * height);
     std::vector<float> value_data(OUTPUTS_VALUE * width * height);
 #ifdef USE_OPENCL_SELFCHECK
@@ -830,6 +939,12 @@ Network::Netresult Network::get_output_internal(const GameState* const state,
     (void)selfcheck;
 #endif
 
+    return process_output(policy_data, value_data, symmetry);
+}
+
+Network::Netresult Network::process_output(std::vector<float>& policy_data,
+                                           std::vector<float>& value_data,
+                                           const int symmetry) {
     // Get the moves
     batchnorm<NUM_INTERSECTIONS>(OUTPUTS_POLICY, policy_data,
                                  m_bn_pol_w1.data(), m_bn_pol_w2.data());
@@ -934,6 +1049,17 @@ void Network::fill_input_plane_pair(const FullBoard& board,
 
 std::vector<float> Network::gather_features(const GameState* const state,
                                             const int symmetry) {
+    return gather_features_impl(state, symmetry);
+}
+
+std::vector<float> Network::gather_features(const SearchState* const state,
+                                            const int symmetry) {
+    return gather_features_impl(state, symmetry);
+}
+
+template <typename State>
+std::vector<float> Network::gather_features_impl(const State* const state,
+                                                 const int symmetry) {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
     auto input_data = std::vector<float>(INPUT_CHANNELS * NUM_INTERSECTIONS);
 
@@ -1049,6 +1175,10 @@ void Network::nncache_clear() {
     m_nncache.clear();
 }
 
+NNCache::Stats Network::nncache_stats() {
+    return m_nncache.get_stats();
+}
+
 void Network::drain_evals() {
     m_forward->drain();
 }
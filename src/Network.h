@@ -63,6 +63,8 @@ constexpr auto WINOGRAD_TILE = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
 constexpr auto WINOGRAD_P = WINOGRAD_WTILES * WINOGRAD_WTILES;
 constexpr auto SQ2 = 1.4142135623730951f; // Square root of 2
 
+class SearchState;
+
 // See drain_evals() / resume_evals() for details.
 class NetworkHaltException : public std::exception {};
 
@@ -83,6 +85,13 @@ public:
     Netresult get_output(const GameState* state, Ensemble ensemble,
                          int symmetry = -1, bool read_cache = true,
                          bool write_cache = true, bool force_selfcheck = false);
+    Netresult get_output(const SearchState* state, Ensemble ensemble,
+                         int symmetry = -1, bool read_cache = true,
+                         bool write_cache = true, bool force_selfcheck = false);
+    // RANDOM_SYMMETRY evaluation of several positions.  Cache misses are
+    // submitted to the forward pipe together so they can share a batch.
+    std::vector<Netresult> get_output_batch(
+        const std::vector<const SearchState*>& states);
 
     static constexpr auto INPUT_MOVES = 8;
     static constexpr auto INPUT_CHANNELS = 2 * INPUT_MOVES + 2;
@@ -91,6 +100,10 @@ public:
     static constexpr auto VALUE_LAYER = 256;
 
     void initialize(int playouts, const std::string& weightsfile);
+    // Identifies the weights and softmax temperature.
+    std::uint64_t get_network_hash() const {
+        return m_network_hash;
+    }
 
     float benchmark_time(int centiseconds);
     void benchmark(const GameState* state, int iterations = 1600);
@@ -99,6 +112,8 @@ public:
 
     static std::vector<float> gather_features(const GameState* state,
                                               int symmetry);
+    static std::vector<float> gather_features(const SearchState* state,
+                                              int symmetry);
     static std::pair<int, int> get_symmetry(const std::pair<int, int>& vertex,
                                             int symmetry,
                                             int board_size = BOARD_SIZE);
@@ -107,6 +122,7 @@ public:
     size_t get_estimated_cache_size();
     void nncache_resize(int max_count);
     void nncache_clear();
+    NNCache::Stats nncache_stats();
 
     // 'Drain' evaluations.  Threads with an evaluation will throw a
     // NetworkHaltException if possible, or will just proceed and drain ASAP.
@@ -138,13 +154,38 @@ private:
     static void winograd_sgemm(const std::vector<float>& U,
                                const std::vector<float>& V,
                                std::vector<float>& M, int C, int K);
-    Netresult get_output_internal(const GameState* state, int symmetry,
+    // For both GameState and SearchState, defined in Network.cpp.
+    template <typename State>
+    Netresult get_output_impl(const State* state, Ensemble ensemble,
+                              int symmetry, bool read_cache, bool write_cache,
+                              bool force_selfcheck);
+    template <typename State>
+    Netresult get_output_internal(const State* state, int symmetry,
                                   bool selfcheck = false);
+    Netresult process_output(std::vector<float>& policy_data,
+                             std::vector<float>& value_data, int symmetry);
+    template <typename State>
+    static std::vector<float> gather_features_impl(const State* state,
+                                                   int symmetry);
     static void fill_input_plane_pair(const FullBoard& board,
                                       std::vector<float>::iterator black,
                                       std::vector<float>::iterator white,
                                       int symmetry);
-    bool probe_cache(const GameState* state, Network::Netresult& result);
+    template <typename State>
+    bool probe_cache(const State* state, Network::Netresult& result);
+    // Shared by get_output_impl() and get_output_batch(). lookup_output()
+    // returns true if the result needs no evaluation: a cache hit, or a
+    // board of another size. store_output() makes the winrate that of the
+    // side to move and caches the result.
+    template <typename State>
+    bool lookup_output(const State* state, Netresult& result,
+                       bool read_cache);
+    template <typename State>
+    void selfcheck_output(const State* state, const Netresult& result,
+                          int symmetry, bool force_selfcheck);
+    template <typename State>
+    void store_output(const State* state, Netresult& result,
+                      bool write_cache);
     std::unique_ptr<ForwardPipe>&& init_net(
         int channels, std::unique_ptr<ForwardPipe>&& pipe);
 #ifdef USE_HALF
@@ -160,6 +201,9 @@ private:
 
     size_t estimated_size{0};
 
+    // Hash of the weights, see load_network_file().
+    std::uint64_t m_network_hash{0};
+
     // Residual tower
     std::shared_ptr<ForwardPipeWeights> m_fwd_weights;
 
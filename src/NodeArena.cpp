@@ -0,0 +1,273 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "NodeArena.h"
+
+namespace {
+
+constexpr size_t GRANULE = 16;
+// Enough for the children of a node with every move legal.
+constexpr size_t MAX_BLOCK = 16384;
+constexpr size_t NUM_CLASSES = MAX_BLOCK / GRANULE;
+constexpr size_t SLAB_SIZE = 256 * 1024;
+// Number of blocks exchanged with the shared pool at once, fewer
+// for the large size classes.
+constexpr size_t BATCH = 256;
+constexpr size_t BATCH_BYTES = 64 * 1024;
+
+static_assert(alignof(std::max_align_t) <= GRANULE,
+              "Blocks must be suitably aligned for any type");
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct FreeList {
+    FreeBlock* head{nullptr};
+    size_t count{0};
+};
+
+size_t size_class(const size_t bytes) {
+    return bytes ? (bytes + GRANULE - 1) / GRANULE - 1 : 0;
+}
+
+size_t batch_size(const size_t cls) {
+    const auto block_size = (cls + 1) * GRANULE;
+    return std::max(size_t{1}, std::min(BATCH, BATCH_BYTES / block_size));
+}
+
+class SharedPool {
+public:
+    bool take(const size_t cls, FreeList& list) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& batches = m_batches[cls];
+        if (batches.empty()) {
+            return false;
+        }
+        list = batches.back();
+        batches.pop_back();
+        return true;
+    }
+
+    void give(const size_t cls, const FreeList& list) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_batches[cls].push_back(list);
+    }
+
+    // Unused end of a slab, left by a thread which exits or moves on to
+    // a new slab.
+    void give_remainder(char* const pos, char* const end) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_remainders.emplace_back(pos, end);
+    }
+
+    bool take_remainder(const size_t min_bytes, char*& pos, char*& end) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& remainder : m_remainders) {
+            if (remainder.second - remainder.first
+                >= std::ptrdiff_t(min_bytes)) {
+                std::tie(pos, end) = remainder;
+                remainder = m_remainders.back();
+                m_remainders.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    char* new_slab() {
+        auto slab = std::make_unique<char[]>(SLAB_SIZE);
+        auto ptr = slab.get();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slabs.emplace_back(std::move(slab));
+        m_reserved += SLAB_SIZE;
+        return ptr;
+    }
+
+    size_t get_reserved_size() const {
+        return m_reserved;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::array<std::vector<FreeList>, NUM_CLASSES> m_batches;
+    std::vector<std::pair<char*, char*>> m_remainders;
+    std::vector<std::unique_ptr<char[]>> m_slabs;
+    std::atomic<size_t> m_reserved{0};
+};
+
+// Never destroyed: trees can outlive static destruction order.
+SharedPool& shared_pool() {
+    static auto pool = new SharedPool;
+    return *pool;
+}
+
+class ThreadCache {
+public:
+    ~ThreadCache() {
+        for (auto cls = size_t{0}; cls < NUM_CLASSES; cls++) {
+            if (m_lists[cls].head) {
+                shared_pool().give(cls, m_lists[cls]);
+            }
+        }
+        give_remainder();
+    }
+
+    void* allocate(const size_t cls) {
+        auto& list = m_lists[cls];
+        if (!list.head) {
+            refill(cls);
+        }
+        auto block = list.head;
+        list.head = block->next;
+        list.count--;
+        return block;
+    }
+
+    void deallocate(void* const ptr, const size_t cls) {
+        auto& list = m_lists[cls];
+        auto block = static_cast<FreeBlock*>(ptr);
+        block->next = list.head;
+        list.head = block;
+        list.count++;
+
+        // Freeing a large subtree would otherwise pile up blocks
+        // that other threads can't use.
+        const auto batch_count = batch_size(cls);
+        if (list.count >= 2 * batch_count) {
+            auto batch = FreeList{list.head, batch_count};
+            auto last = list.head;
+            for (auto i = size_t{1}; i < batch_count; i++) {
+                last = last->next;
+            }
+            list.head = last->next;
+            list.count -= batch_count;
+            last->next = nullptr;
+            shared_pool().give(cls, batch);
+        }
+    }
+
+private:
+    void refill(const size_t cls) {
+        auto& list = m_lists[cls];
+        if (shared_pool().take(cls, list)) {
+            return;
+        }
+
+        const auto block_size = (cls + 1) * GRANULE;
+        if (m_slab_end - m_slab_pos < std::ptrdiff_t(block_size)) {
+            give_remainder();
+            if (!shared_pool().take_remainder(block_size, m_slab_pos,
+                                              m_slab_end)) {
+                m_slab_pos = shared_pool().new_slab();
+                m_slab_end = m_slab_pos + SLAB_SIZE;
+            }
+        }
+        while (list.count < batch_size(cls)
+               && m_slab_end - m_slab_pos >= std::ptrdiff_t(block_size)) {
+            auto block = reinterpret_cast<FreeBlock*>(m_slab_pos);
+            block->next = list.head;
+            list.head = block;
+            list.count++;
+            m_slab_pos += block_size;
+        }
+    }
+
+    void give_remainder() {
+        if (m_slab_end - m_slab_pos >= std::ptrdiff_t(GRANULE)) {
+            shared_pool().give_remainder(m_slab_pos, m_slab_end);
+        }
+        m_slab_pos = m_slab_end = nullptr;
+    }
+
+    std::array<FreeList, NUM_CLASSES> m_lists;
+    char* m_slab_pos{nullptr};
+    char* m_slab_end{nullptr};
+};
+
+thread_local bool t_cache_destroyed = false;
+thread_local ThreadCache* t_orphan_cache = nullptr;
+
+struct ThreadCacheHolder {
+    ~ThreadCacheHolder() {
+        t_cache_destroyed = true;
+    }
+    ThreadCache cache;
+};
+
+thread_local ThreadCacheHolder t_holder;
+
+ThreadCache& thread_cache() {
+    if (t_cache_destroyed) {
+        // Tree memory freed while the thread exits, e.g. by the
+        // destructors of static objects. Leaked on purpose.
+        if (!t_orphan_cache) {
+            t_orphan_cache = new ThreadCache;
+        }
+        return *t_orphan_cache;
+    }
+    return t_holder.cache;
+}
+
+}
+
+void* NodeArena::allocate(const size_t bytes) {
+    if (bytes > MAX_BLOCK) {
+        return ::operator new(bytes);
+    }
+    return thread_cache().allocate(size_class(bytes));
+}
+
+void NodeArena::deallocate(void* const ptr, const size_t bytes) {
+    if (!ptr) {
+        return;
+    }
+    if (bytes > MAX_BLOCK) {
+        ::operator delete(ptr);
+        return;
+    }
+    thread_cache().deallocate(ptr, size_class(bytes));
+}
+
+size_t NodeArena::get_reserved_size() {
+    return shared_pool().get_reserved_size();
+}
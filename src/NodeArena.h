@@ -0,0 +1,83 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef NODEARENA_H_INCLUDED
+#define NODEARENA_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+
+// Slab allocator for the search tree. UCTNode instances and child arrays
+// are carved from large slabs in 16 byte size classes. Every thread keeps
+// its own free lists, so allocating nodes during the search, or freeing a
+// whole discarded subtree, takes no lock except to hand complete batches
+// of blocks to or from the shared pool. A thread which exits hands its
+// free blocks and the uncarved end of its slab back to the pool.
+//
+// There is no bulk release: the nodes of the reused and the discarded
+// parts of a tree share slabs, so subtrees are still freed node by node,
+// each free being a push on a thread-local list. Slabs are never returned
+// to the system, they are reused by later trees.
+namespace NodeArena {
+    void* allocate(size_t bytes);
+    void deallocate(void* ptr, size_t bytes);
+
+    // Bytes reserved in slabs, whether in use or not.
+    size_t get_reserved_size();
+
+    // For containers that live in the tree.
+    template <typename T>
+    class Allocator {
+    public:
+        using value_type = T;
+
+        Allocator() = default;
+        template <typename U>
+        Allocator(const Allocator<U>&) {}
+
+        T* allocate(const size_t n) {
+            return static_cast<T*>(NodeArena::allocate(n * sizeof(T)));
+        }
+        void deallocate(T* const ptr, const size_t n) {
+            NodeArena::deallocate(ptr, n * sizeof(T));
+        }
+    };
+
+    template <typename T, typename U>
+    bool operator==(const Allocator<T>&, const Allocator<U>&) {
+        return true;
+    }
+    template <typename T, typename U>
+    bool operator!=(const Allocator<T>&, const Allocator<U>&) {
+        return false;
+    }
+}
+
+#endif
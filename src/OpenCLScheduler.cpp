@@ -257,28 +257,54 @@ template <typename net_t>
 void OpenCLScheduler<net_t>::forward(const std::vector<float>& input,
                                      std::vector<float>& output_pol,
                                      std::vector<float>& output_val) {
-    auto entry =
-        std::make_shared<ForwardQueueEntry>(input, output_pol, output_val);
-    std::unique_lock<std::mutex> lk(entry->mutex);
+    enqueue_and_wait({std::make_shared<ForwardQueueEntry>(input, output_pol,
+                                                          output_val)});
+}
+
+template <typename net_t>
+void OpenCLScheduler<net_t>::forward_batch(
+    const std::vector<std::vector<float>>& inputs,
+    std::vector<std::vector<float>>& output_pol,
+    std::vector<std::vector<float>>& output_val) {
+    auto entries = std::vector<std::shared_ptr<ForwardQueueEntry>>{};
+    entries.reserve(inputs.size());
+    for (auto i = size_t{0}; i < inputs.size(); i++) {
+        entries.emplace_back(std::make_shared<ForwardQueueEntry>(
+            inputs[i], output_pol[i], output_val[i]));
+    }
+    enqueue_and_wait(entries);
+}
+
+template <typename net_t>
+void OpenCLScheduler<net_t>::enqueue_and_wait(
+    const std::vector<std::shared_ptr<ForwardQueueEntry>>& entries) {
     {
         std::unique_lock<std::mutex> lk(m_mutex);
-        m_forward_queue.push_back(entry);
+        m_forward_queue.insert(end(m_forward_queue), begin(entries),
+                               end(entries));
 
         if (m_single_eval_in_progress.load()) {
             m_waittime += 2;
         }
     }
-    m_cv.notify_one();
-    entry->cv.wait(lk);
+    // Several entries can complete a batch on their own.
+    if (entries.size() > 1) {
+        m_cv.notify_all();
+    } else {
+        m_cv.notify_one();
+    }
+
+    for (auto& entry : entries) {
+        std::unique_lock<std::mutex> lk(entry->mutex);
+        entry->cv.wait(lk, [&entry]() { return entry->done; });
+    }
 
     if (m_draining) {
         throw NetworkHaltException();
     }
 }
 
-#ifndef NDEBUG
 struct batch_stats_t batch_stats;
-#endif
 
 template <typename net_t>
 void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
@@ -364,13 +390,12 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
             return;
         }
 
-#ifndef NDEBUG
         if (count == 1) {
             batch_stats.single_evals++;
         } else {
             batch_stats.batch_evals++;
         }
-#endif
+        batch_stats.positions += count;
 
         // prepare input for forward() call
         batch_input.resize(in_size * count);
@@ -398,6 +423,10 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
             std::copy(begin(batch_output_val) + out_val_size * index,
                       begin(batch_output_val) + out_val_size * (index + 1),
                       begin(x->out_v));
+            {
+                std::unique_lock<std::mutex> lk(x->mutex);
+                x->done = true;
+            }
             x->cv.notify_all();
             index++;
         }
@@ -425,8 +454,8 @@ void OpenCLScheduler<net_t>::drain() {
 
     for (auto& x : fq) {
         {
-            // dummy lock/unlock to make sure thread in forward() is sleeping
             std::unique_lock<std::mutex> lk(x->mutex);
+            x->done = true;
         }
         x->cv.notify_all();
     }
@@ -40,13 +40,13 @@
 #include "SMP.h"
 #include "ThreadPool.h"
 
-#ifndef NDEBUG
 struct batch_stats_t {
     std::atomic<size_t> single_evals{0};
     std::atomic<size_t> batch_evals{0};
+    // Positions evaluated in all batches, for the batch fill.
+    std::atomic<size_t> positions{0};
 };
 extern batch_stats_t batch_stats;
-#endif
 
 template <typename net_t>
 class OpenCLScheduler : public ForwardPipe {
@@ -57,6 +57,9 @@ class OpenCLScheduler : public ForwardPipe {
         const std::vector<float>& in;
         std::vector<float>& out_p;
         std::vector<float>& out_v;
+        // Set, under mutex, once out_p and out_v are written or the
+        // entry is dropped by drain().
+        bool done{false};
         ForwardQueueEntry(const std::vector<float>& input,
                           std::vector<float>& output_pol,
                           std::vector<float>& output_val)
@@ -71,6 +74,9 @@ public:
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<std::vector<float>>& inputs,
+                               std::vector<std::vector<float>>& output_pol,
+                               std::vector<std::vector<float>>& output_val);
     virtual bool needs_autodetect();
     virtual void push_weights(
         unsigned int filter_size, unsigned int channels, unsigned int outputs,
@@ -95,6 +101,8 @@ private:
     std::list<std::thread> m_worker_threads;
 
     void batch_worker(size_t gnum);
+    void enqueue_and_wait(
+        const std::vector<std::shared_ptr<ForwardQueueEntry>>& entries);
     void push_input_convolution(unsigned int filter_size, unsigned int channels,
                                 unsigned int outputs,
                                 const std::vector<float>& weights,
@@ -27,31 +27,94 @@
     work.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <thread>
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
 #include "SMP.h"
 
+namespace {
+    std::atomic<bool> s_profiling{false};
+    std::atomic<SMP::LockSite*> s_sites{nullptr};
+
+    // Spins before yielding, and the longest backoff in pauses.
+    constexpr auto SPIN_LIMIT = 64;
+    constexpr auto MAX_BACKOFF = 64;
+
+    inline void cpu_pause() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+    }
+}
+
 SMP::Mutex::Mutex() {
     m_lock = false;
 }
 
-SMP::Lock::Lock(Mutex& m) {
-    m_mutex = &m;
+SMP::LockSite::LockSite(const char* const file, const int line)
+    : m_file(file), m_line(line), m_next(s_sites.load()) {
+    while (!s_sites.compare_exchange_weak(m_next, this)) {}
+}
+
+SMP::Lock::Lock(Mutex& m, LockSite* const site) : m_mutex(&m), m_site(site) {
     lock();
 }
 
 void SMP::Lock::lock() {
     assert(!m_owns_lock);
-    // Test and Test-and-Set reduces memory contention
-    // However, just trying to Test-and-Set first improves performance in almost
-    // all cases
-    while (m_mutex->m_lock.exchange(true, std::memory_order_acquire)) {
-        while (m_mutex->m_lock.load(std::memory_order_relaxed)) {}
+    // Just trying to Test-and-Set first improves performance in almost
+    // all cases.
+    if (!m_mutex->m_lock.exchange(true, std::memory_order_acquire)) {
+        if (m_site && s_profiling.load(std::memory_order_relaxed)) {
+            m_site->m_acquires.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        lock_contended();
     }
     m_owns_lock = true;
 }
 
+void SMP::Lock::lock_contended() {
+    const auto profiling = m_site && s_profiling.load(std::memory_order_relaxed);
+    const auto start = profiling ? std::chrono::steady_clock::now()
+                                 : std::chrono::steady_clock::time_point{};
+    auto spins = std::uint64_t{0};
+    auto backoff = 1;
+    // Test and Test-and-Set reduces memory contention.
+    do {
+        while (m_mutex->m_lock.load(std::memory_order_relaxed)) {
+            if (spins < SPIN_LIMIT) {
+                for (auto i = 0; i < backoff; i++) {
+                    cpu_pause();
+                }
+                backoff = std::min(2 * backoff, MAX_BACKOFF);
+            } else {
+                std::this_thread::yield();
+            }
+            spins++;
+        }
+    } while (m_mutex->m_lock.exchange(true, std::memory_order_acquire));
+
+    if (profiling) {
+        const auto wait = std::chrono::steady_clock::now() - start;
+        m_site->m_acquires.fetch_add(1, std::memory_order_relaxed);
+        m_site->m_contended.fetch_add(1, std::memory_order_relaxed);
+        m_site->m_spins.fetch_add(spins, std::memory_order_relaxed);
+        m_site->m_wait_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count(),
+            std::memory_order_relaxed);
+    }
+}
 void SMP::Lock::unlock() {
     assert(m_owns_lock);
     auto lock_held = m_mutex->m_lock.exchange(false, std::memory_order_release);
@@ -76,3 +139,39 @@ SMP::Lock::~Lock() {
 size_t SMP::get_num_cpus() {
     return std::thread::hardware_concurrency();
 }
+
+void SMP::set_lock_profiling(const bool enable) {
+    s_profiling = enable;
+}
+
+bool SMP::lock_profiling() {
+    return s_profiling;
+}
+
+std::vector<SMP::LockSiteStats> SMP::get_lock_profile() {
+    auto profile = std::vector<LockSiteStats>{};
+    for (auto site = s_sites.load(); site; site = site->m_next) {
+        if (site->m_acquires == 0) {
+            continue;
+        }
+        auto file = std::string{site->m_file};
+        file = file.substr(file.find_last_of("/\\") + 1);
+        profile.push_back({file + ":" + std::to_string(site->m_line),
+                           site->m_acquires, site->m_contended, site->m_spins,
+                           site->m_wait_ns / 1e6});
+    }
+    std::stable_sort(begin(profile), end(profile),
+                     [](const auto& a, const auto& b) {
+                         return a.wait_ms > b.wait_ms;
+                     });
+    return profile;
+}
+
+void SMP::reset_lock_profile() {
+    for (auto site = s_sites.load(); site; site = site->m_next) {
+        site->m_acquires = 0;
+        site->m_contended = 0;
+        site->m_spins = 0;
+        site->m_wait_ns = 0;
+    }
+}
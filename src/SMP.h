@@ -34,6 +34,9 @@
 
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 namespace SMP {
     size_t get_num_cpus();
@@ -48,20 +51,64 @@ namespace SMP {
         std::atomic<bool> m_lock;
     };
 
+    struct LockSiteStats;
+
+    // Where a lock is taken, see LOCK(). Collects contention statistics
+    // while lock profiling is on.
+    class LockSite {
+    public:
+        LockSite(const char* file, int line);
+
+    private:
+        friend class Lock;
+        friend std::vector<LockSiteStats> get_lock_profile();
+        friend void reset_lock_profile();
+
+        const char* m_file;
+        int m_line;
+        std::atomic<std::uint64_t> m_acquires{0};
+        std::atomic<std::uint64_t> m_contended{0};
+        std::atomic<std::uint64_t> m_spins{0};
+        std::atomic<std::uint64_t> m_wait_ns{0};
+        LockSite* m_next;
+    };
+
+    // Spins with exponential backoff while the lock is held, then
+    // yields the CPU between attempts.
     class Lock {
     public:
-        explicit Lock(Mutex& m);
+        explicit Lock(Mutex& m, LockSite* site = nullptr);
         ~Lock();
         void lock();
         void unlock();
 
     private:
+        void lock_contended();
+
         Mutex* m_mutex;
+        LockSite* m_site;
         bool m_owns_lock{false};
     };
+
+    struct LockSiteStats {
+        std::string site;
+        std::uint64_t acquires;
+        std::uint64_t contended;
+        std::uint64_t spins;
+        double wait_ms;
+    };
+    // Lock profiling is off by default, it adds shared counters to
+    // every lock. The profile lists the sites which were used, the
+    // ones with the most waiting first.
+    void set_lock_profiling(bool enable);
+    bool lock_profiling();
+    std::vector<LockSiteStats> get_lock_profile();
+    void reset_lock_profile();
 }
 
 // Avoids accidentally creating a temporary
-#define LOCK(mutex, lock) SMP::Lock lock((mutex))
+#define LOCK(mutex, lock)                                         \
+    static SMP::LockSite lock##_site(__FILE__, __LINE__);         \
+    SMP::Lock lock((mutex), &lock##_site)
 
 #endif
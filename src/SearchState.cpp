@@ -0,0 +1,90 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+
+#include "SearchState.h"
+
+SearchState::SearchState(const GameState& root) {
+    reset(root);
+    // Room for the deepest playouts, to avoid growing it while searching.
+    reserve_ko_hash_history(root.get_movenum() + 2 * NUM_INTERSECTIONS);
+}
+
+void SearchState::reset(const GameState& root) {
+    // Copy assignment reuses the ko hash history storage.
+    static_cast<KoState&>(*this) = root;
+    m_root = &root;
+    m_head = 0;
+    m_moves = 0;
+    m_undoable = 0;
+}
+
+void SearchState::play_move(const int vertex) {
+    m_history[m_head] = *this;
+    m_head = (m_head + 1) % HISTORY_SIZE;
+    m_moves++;
+    if (m_undoable < HISTORY_SIZE) {
+        m_undoable++;
+    }
+    KoState::play_move(vertex);
+}
+
+bool SearchState::undo_move() {
+    if (m_undoable == 0) {
+        return false;
+    }
+    m_head = (m_head + HISTORY_SIZE - 1) % HISTORY_SIZE;
+    static_cast<FastState&>(*this) = m_history[m_head];
+    pop_ko_hash();
+    m_moves--;
+    m_undoable--;
+    return true;
+}
+
+const FullBoard& SearchState::get_past_board(const int moves_ago) const {
+    assert(moves_ago >= 0 && size_t(moves_ago) <= m_movenum);
+    if (moves_ago == 0) {
+        return board;
+    }
+    if (size_t(moves_ago) <= std::min(m_moves, HISTORY_SIZE)) {
+        const auto index = (m_head + HISTORY_SIZE - moves_ago) % HISTORY_SIZE;
+        return m_history[index].board;
+    }
+    assert(size_t(moves_ago) > m_moves);
+    return m_root->get_past_board(moves_ago - m_moves);
+}
+
+const TimeControl& SearchState::get_timecontrol() const {
+    return m_root->get_timecontrol();
+}
@@ -0,0 +1,86 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SEARCHSTATE_H_INCLUDED
+#define SEARCHSTATE_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstddef>
+
+#include "FastState.h"
+#include "FullBoard.h"
+#include "GameState.h"
+#include "KoState.h"
+#include "Network.h"
+#include "TimeControl.h"
+
+// Position during a playout. Unlike GameState, it only keeps what the
+// search needs: the ko hashes of the game for superko detection (in
+// KoState), and the boards for the network input. The boards of the last
+// moves are kept in a ring buffer, older ones are read from the root.
+//
+// Moves are made and taken back in place. A worker resets one instance to
+// the root for every playout, which needs no heap allocation once the ko
+// hash history has grown to the length of the game.
+class SearchState : public KoState {
+public:
+    explicit SearchState(const GameState& root);
+
+    // Back to the root position. The root must not change while
+    // this state refers to it.
+    void reset(const GameState& root);
+
+    void play_move(int vertex);
+    // Take back the last move. Only the last INPUT_MOVES moves made since
+    // the root can be taken back.
+    bool undo_move();
+
+    const FullBoard& get_past_board(int moves_ago) const;
+    // Moves made since the root.
+    size_t get_root_depth() const {
+        return m_moves;
+    }
+    const TimeControl& get_timecontrol() const;
+
+private:
+    static constexpr auto HISTORY_SIZE = size_t{Network::INPUT_MOVES};
+
+    const GameState* m_root;
+    // States before the last moves, m_history[m_head - 1] is the
+    // most recent one.
+    std::array<FastState, HISTORY_SIZE> m_history;
+    size_t m_head{0};
+    // Moves made since the root, and how many of those can be taken back.
+    size_t m_moves{0};
+    size_t m_undoable{0};
+};
+
+#endif
@@ -0,0 +1,124 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SelfPlay.h"
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "GameState.h"
+#include "SGFTree.h"
+#include "Timing.h"
+#include "Training.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+namespace {
+    // Same limit as autogtp.
+    constexpr auto MAX_MOVES = 2 * NUM_INTERSECTIONS;
+
+    int play_game(Network& network, GameState& game) {
+        game.init_game(BOARD_SIZE, KOMI);
+        game.set_timecontrol(0, 1, 0, 0); // Set infinite time.
+        UCTSearch search{game, network};
+        search.set_thread_limit(1);
+        search.set_network_shared(true);
+
+        Training::clear_training();
+        while (!game.has_resigned() && game.get_passes() < 2
+               && game.get_movenum() < MAX_MOVES) {
+            const auto move = search.think(game.get_to_move());
+            game.play_move(move);
+        }
+
+        if (game.has_resigned()) {
+            return game.who_resigned() == FastBoard::BLACK ? FastBoard::WHITE
+                                                           : FastBoard::BLACK;
+        }
+        const auto score = game.final_score();
+        if (score > 0.0f) {
+            return FastBoard::BLACK;
+        } else if (score < 0.0f) {
+            return FastBoard::WHITE;
+        }
+        return FastBoard::EMPTY;
+    }
+}
+
+void SelfPlay::run(Network& network, const int games,
+                   const std::string& basename) {
+    myprintf_error("Playing %d games, %d at once.\n", games,
+                   int(thread_pool.size()));
+    const auto start = Time{};
+    std::atomic<int> next{0};
+    std::mutex out_mutex;
+    OutputChunker chunker{basename, true, cfg_training_compression};
+    std::ofstream sgf_file{basename + ".sgf", std::ofstream::app};
+    auto played = 0;
+
+    // Each game waits on its own thread for its search, which runs on
+    // the thread pool.
+    auto players = std::vector<std::thread>{};
+    for (auto i = size_t{0}; i < thread_pool.size(); i++) {
+        players.emplace_back([&]() {
+            GameState game;
+            while (next++ < games) {
+                const auto winner = play_game(network, game);
+
+                std::lock_guard<std::mutex> lock(out_mutex);
+                Training::dump_training(winner, chunker);
+                sgf_file << SGFTree::state_to_string(game, FastBoard::BLACK)
+                         << std::endl;
+                played++;
+                const auto hours =
+                    Time::timediff_seconds(start, Time{}) / 3600.0;
+                myprintf_error("Game %d: %s, %d moves, %.1f games/hour.\n",
+                               played,
+                               winner == FastBoard::BLACK   ? "B+"
+                               : winner == FastBoard::WHITE ? "W+"
+                                                            : "draw",
+                               int(game.get_movenum()), played / hours);
+            }
+            Training::clear_training();
+        });
+    }
+    for (auto& player : players) {
+        player.join();
+    }
+}
@@ -0,0 +1,51 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SELFPLAY_H_INCLUDED
+#define SELFPLAY_H_INCLUDED
+
+#include "config.h"
+
+#include <string>
+
+class Network;
+
+// Plays games against itself without a GTP driver. As many games as there
+// are threads run at once, each searched by one thread, and all of them
+// share the network and its cache, so the network sees one evaluation per
+// thread at a time while the process needs a single copy of the weights.
+//
+// The training data goes to chunks of OutputChunker::CHUNK_SIZE games,
+// named basename.0.gz, basename.1.gz and so on, and the games are
+// appended to basename.sgf.
+namespace SelfPlay {
+    void run(Network& network, int games, const std::string& basename);
+}
+
+#endif
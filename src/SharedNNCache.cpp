@@ -0,0 +1,262 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "SharedNNCache.h"
+
+#include "Utils.h"
+
+using namespace Utils;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "Shared memory cache needs address-free atomics");
+
+static constexpr std::uint32_t SEGMENT_MAGIC = 0x4C5A4E43; // "LZNC"
+static constexpr std::uint32_t SEGMENT_VERSION = 1;
+
+struct SharedNNCache::Header {
+    // Written last by the creating process, once the rest is valid.
+    std::atomic<std::uint32_t> magic;
+    std::uint32_t version;
+    std::uint64_t net_hash;
+    std::uint64_t slot_count;
+    std::uint64_t slot_size;
+    std::atomic<std::int32_t> attached;
+};
+
+struct SharedNNCache::Slot {
+    // Even when stable, odd while a writer is updating the slot.
+    // Zero means the slot was never written.
+    std::atomic<std::uint64_t> seq;
+    std::atomic<std::uint64_t> key;
+    NNCache::Netresult result;
+};
+
+// Keep the slots cache line aligned.
+static constexpr size_t HEADER_BYTES = 64;
+static_assert(sizeof(std::atomic<std::uint32_t>) + sizeof(std::uint32_t)
+                      + 3 * sizeof(std::uint64_t)
+                      + sizeof(std::atomic<std::int32_t>)
+                  <= HEADER_BYTES,
+              "Shared cache header does not fit");
+
+std::string SharedNNCache::segment_name(const std::uint64_t net_hash) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/leelaz-nncache-%016llx",
+             static_cast<unsigned long long>(net_hash));
+    return buf;
+}
+
+SharedNNCache::SharedNNCache(const std::string& name, void* const base,
+                             const size_t size)
+    : m_name(name),
+      m_size(size),
+      m_header(static_cast<Header*>(base)),
+      m_slots(reinterpret_cast<Slot*>(static_cast<char*>(base) + HEADER_BYTES)),
+      m_slot_count(m_header->slot_count) {}
+
+#ifdef _WIN32
+
+std::unique_ptr<SharedNNCache> SharedNNCache::attach(const std::uint64_t,
+                                                     const size_t) {
+    myprintf("Shared NN cache is not supported on this platform.\n");
+    return nullptr;
+}
+
+SharedNNCache::~SharedNNCache() {}
+
+#else
+
+std::unique_ptr<SharedNNCache> SharedNNCache::attach(
+    const std::uint64_t net_hash, const size_t size) {
+    if (size <= HEADER_BYTES + sizeof(Slot)) {
+        return nullptr;
+    }
+    const auto name = segment_name(net_hash);
+    const auto slot_count = (size - HEADER_BYTES) / sizeof(Slot);
+    auto bytes = HEADER_BYTES + slot_count * sizeof(Slot);
+
+    auto creator = true;
+    auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1 && errno == EEXIST) {
+        creator = false;
+        fd = shm_open(name.c_str(), O_RDWR, 0600);
+    }
+    if (fd == -1) {
+        myprintf("Could not open shared NN cache %s.\n", name.c_str());
+        return nullptr;
+    }
+
+    if (creator) {
+        // ftruncate zero fills, which is a valid empty table.
+        if (ftruncate(fd, bytes) != 0) {
+            myprintf("Could not size shared NN cache %s.\n", name.c_str());
+            close(fd);
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+    } else {
+        // The creator may not have sized the segment yet.
+        struct stat st;
+        st.st_size = 0;
+        for (auto tries = 0; tries < 100; tries++) {
+            if (fstat(fd, &st) != 0 || st.st_size > 0) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (size_t(st.st_size) <= HEADER_BYTES) {
+            myprintf("Shared NN cache %s is not usable.\n", name.c_str());
+            close(fd);
+            return nullptr;
+        }
+        bytes = st.st_size;
+    }
+
+    auto base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        myprintf("Could not map shared NN cache %s.\n", name.c_str());
+        if (creator) {
+            shm_unlink(name.c_str());
+        }
+        return nullptr;
+    }
+
+    auto header = static_cast<Header*>(base);
+    if (creator) {
+        new (header) Header;
+        header->version = SEGMENT_VERSION;
+        header->net_hash = net_hash;
+        header->slot_count = slot_count;
+        header->slot_size = sizeof(Slot);
+        header->attached = 1;
+        header->magic.store(SEGMENT_MAGIC, std::memory_order_release);
+    } else {
+        for (auto tries = 0; tries < 100; tries++) {
+            if (header->magic.load(std::memory_order_acquire)
+                == SEGMENT_MAGIC) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (header->magic.load(std::memory_order_acquire) != SEGMENT_MAGIC
+            || header->version != SEGMENT_VERSION
+            || header->net_hash != net_hash
+            || header->slot_size != sizeof(Slot)
+            || HEADER_BYTES + header->slot_count * header->slot_size
+                   != bytes) {
+            myprintf("Shared NN cache %s is incompatible, not using it.\n",
+                     name.c_str());
+            munmap(base, bytes);
+            return nullptr;
+        }
+        header->attached++;
+    }
+
+    myprintf("Attached to shared NN cache %s (%zu MiB, %d process(es)).\n",
+             name.c_str(), bytes / (1024 * 1024), header->attached.load());
+
+    return std::unique_ptr<SharedNNCache>(
+        new SharedNNCache(name, base, bytes));
+}
+
+SharedNNCache::~SharedNNCache() {
+    // The last process out removes the segment. A process that dies
+    // without detaching leaves it behind, and it will be reused by the
+    // next process that runs the same network.
+    if (--m_header->attached == 0) {
+        shm_unlink(m_name.c_str());
+    }
+    munmap(m_header, m_size);
+}
+
+#endif
+
+int SharedNNCache::get_attached() const {
+    return m_header->attached.load();
+}
+
+bool SharedNNCache::lookup(const std::uint64_t hash,
+                           NNCache::Netresult& result) {
+    auto& slot = m_slots[hash % m_slot_count];
+
+    const auto seq = slot.seq.load(std::memory_order_acquire);
+    if (seq == 0 || (seq & 1)) {
+        return false; // Empty or being written.
+    }
+    if (slot.key.load(std::memory_order_relaxed) != hash) {
+        return false;
+    }
+    NNCache::Netresult tmp;
+    std::memcpy(&tmp, &slot.result, sizeof(tmp));
+
+    // If a writer got in while we were copying, the data may be torn.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) {
+        return false;
+    }
+    result = tmp;
+    return true;
+}
+
+void SharedNNCache::insert(const std::uint64_t hash,
+                           const NNCache::Netresult& result) {
+    auto& slot = m_slots[hash % m_slot_count];
+
+    auto seq = slot.seq.load(std::memory_order_relaxed);
+    if (seq & 1) {
+        return; // Someone else is writing here, drop ours.
+    }
+    if (seq != 0 && slot.key.load(std::memory_order_relaxed) == hash) {
+        return; // Already present.
+    }
+    if (!slot.seq.compare_exchange_strong(seq, seq + 1,
+                                          std::memory_order_acquire)) {
+        return;
+    }
+    slot.key.store(hash, std::memory_order_relaxed);
+    std::memcpy(&slot.result, &result, sizeof(result));
+    slot.seq.store(seq + 2, std::memory_order_release);
+}
@@ -0,0 +1,87 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SHAREDNNCACHE_H_INCLUDED
+#define SHAREDNNCACHE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "NNCache.h"
+
+// A fixed-size cache of network evaluations that lives in a POSIX shared
+// memory segment, so that several leelaz processes running the same network
+// on one host (autogtp, validation) can share their evaluations.
+//
+// The segment is named after the network hash, so processes only ever
+// attach to results computed by the same weights. The table is
+// direct-mapped and always-replace, and every slot is protected by its own
+// sequence counter (a seqlock), so neither readers nor writers ever block.
+// A writer that finds a slot busy simply drops its result.
+class SharedNNCache {
+public:
+    // Attach to the segment for this network, creating it if no other
+    // process has done so. Returns nullptr if no segment can be used,
+    // in which case the caller should carry on with its private cache.
+    static std::unique_ptr<SharedNNCache> attach(std::uint64_t net_hash,
+                                                 size_t size);
+    ~SharedNNCache();
+
+    bool lookup(std::uint64_t hash, NNCache::Netresult& result);
+    void insert(std::uint64_t hash, const NNCache::Netresult& result);
+
+    // Size of the mapped segment in bytes.
+    size_t get_size() const {
+        return m_size;
+    }
+
+    // Number of processes currently attached to the segment.
+    int get_attached() const;
+
+private:
+    struct Header;
+    struct Slot;
+
+    SharedNNCache(const std::string& name, void* base, size_t size);
+
+    static std::string segment_name(std::uint64_t net_hash);
+
+    std::string m_name;
+    size_t m_size;
+    Header* m_header;
+    Slot* m_slots;
+    size_t m_slot_count;
+};
+
+#endif
@@ -0,0 +1,187 @@
+/*
+    Extended from code:
+    Copyright (c) 2012 Jakob Progsch, Václav Zeman
+    Modifications:
+    Copyright (c) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "ThreadPool.h"
+
+using namespace Utils;
+
+namespace {
+    // Lets a worker find its own deque when it queues a task.
+    thread_local const ThreadPool* t_pool = nullptr;
+    thread_local std::size_t t_queue = 0;
+
+    void pin_to_core(std::thread& thread, const std::size_t core) {
+#ifdef _WIN32
+        SetThreadAffinityMask(thread.native_handle(),
+                              DWORD_PTR{1} << (core % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(core % CPU_SETSIZE, &cpuset);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpuset),
+                               &cpuset);
+#else
+        (void)thread;
+        (void)core;
+#endif
+    }
+}
+
+void ThreadPool::WorkQueue::push_back(Task&& task) {
+    LOCK(m_mutex, lock);
+    const auto size = m_size.load(std::memory_order_relaxed);
+    if (size == m_ring.size()) {
+        // Full: unroll into a ring twice as large.
+        auto ring = std::vector<Task>(std::max(size_t{64}, 2 * size));
+        for (auto i = size_t{0}; i < size; i++) {
+            ring[i] = std::move(m_ring[(m_head + i) % m_ring.size()]);
+        }
+        m_ring = std::move(ring);
+        m_head = 0;
+    }
+    m_ring[(m_head + size) % m_ring.size()] = std::move(task);
+    m_size.store(size + 1, std::memory_order_relaxed);
+}
+
+bool ThreadPool::WorkQueue::pop_back(Task& task) {
+    if (empty()) {
+        return false;
+    }
+    LOCK(m_mutex, lock);
+    const auto size = m_size.load(std::memory_order_relaxed);
+    if (size == 0) {
+        return false;
+    }
+    task = std::move(m_ring[(m_head + size - 1) % m_ring.size()]);
+    m_size.store(size - 1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ThreadPool::WorkQueue::pop_front(Task& task) {
+    if (empty()) {
+        return false;
+    }
+    LOCK(m_mutex, lock);
+    const auto size = m_size.load(std::memory_order_relaxed);
+    if (size == 0) {
+        return false;
+    }
+    task = std::move(m_ring[m_head]);
+    m_head = (m_head + 1) % m_ring.size();
+    m_size.store(size - 1, std::memory_order_relaxed);
+    return true;
+}
+
+void ThreadPool::initialize(const std::size_t threads, const bool pin_threads) {
+    assert(m_threads.empty());
+    for (auto i = size_t{0}; i < threads; i++) {
+        m_queues.emplace_back(std::make_unique<WorkQueue>());
+    }
+    for (auto i = size_t{0}; i < threads; i++) {
+        m_threads.emplace_back(&ThreadPool::worker, this, i);
+        if (pin_threads) {
+            pin_to_core(m_threads.back(), i);
+        }
+    }
+}
+
+void ThreadPool::add_task(Task task) {
+    assert(!m_queues.empty());
+    auto index = t_queue;
+    if (t_pool != this) {
+        index = m_next_queue++ % m_queues.size();
+    }
+    // A worker going to sleep increments m_sleeping before it checks
+    // m_pending, so one of us sees the other's update.
+    m_pending++;
+    m_queues[index]->push_back(std::move(task));
+    if (m_sleeping.load() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+        }
+        m_condvar.notify_one();
+    }
+}
+
+bool ThreadPool::find_task(const std::size_t index, Task& task) {
+    if (m_queues[index]->pop_back(task)) {
+        return true;
+    }
+    for (auto i = size_t{1}; i < m_queues.size(); i++) {
+        if (m_queues[(index + i) % m_queues.size()]->pop_front(task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::is_worker() const {
+    return t_pool == this;
+}
+
+void ThreadPool::worker(const std::size_t index) {
+    t_pool = this;
+    t_queue = index;
+    for (;;) {
+        auto task = Task{};
+        if (find_task(index, task)) {
+            m_pending--;
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_exit && m_pending.load() == 0) {
+            return;
+        }
+        m_sleeping++;
+        m_condvar.wait(lock,
+                       [this] { return m_exit || m_pending.load() > 0; });
+        m_sleeping--;
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condvar.notify_all();
+    for (auto& worker : m_threads) {
+        worker.join();
+    }
+}
@@ -26,114 +26,242 @@
     distribution.
 */
 
+#include <atomic>
 #include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <exception>
 #include <functional>
-#include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "SMP.h"
+
 namespace Utils {
 
-class ThreadPool {
+// Type-erased void() callable.  Callables of up to INLINE_SIZE bytes are
+// stored in place, so that queuing them doesn't allocate.  Larger ones
+// are moved to the heap.
+class Task {
 public:
-    ThreadPool() = default;
-    ~ThreadPool();
+    static constexpr auto INLINE_SIZE = size_t{64};
 
-    // create worker threads.  This version has no initializers.
-    void initialize(std::size_t);
+    Task() = default;
+    template <class F, class = typename std::enable_if<!std::is_same<
+                           typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        using Fn = typename std::decay<F>::type;
+        constexpr auto fits = sizeof(Fn) <= INLINE_SIZE
+                              && alignof(Fn) <= alignof(std::max_align_t)
+                              && std::is_nothrow_move_constructible<Fn>::value;
+        construct<Fn>(std::forward<F>(f), std::integral_constant<bool, fits>{});
+    }
+    Task(Task&& other) noexcept {
+        move_from(other);
+    }
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        reset();
+    }
 
-    // add an extra thread.  The thread calls initializer() before doing
-    // anything, so that the user can initialize per-thread data structures
-    // before doing work.
-    void add_thread(std::function<void()> initializer);
-    template <class F, class... Args>
-    auto add_task(F&& f, Args&&... args)
-        -> std::future<typename std::result_of<F(Args...)>::type>;
+    explicit operator bool() const {
+        return m_ops != nullptr;
+    }
+    void operator()() {
+        m_ops->invoke(&m_storage);
+    }
 
 private:
-    std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
 
-    std::mutex m_mutex;
-    std::condition_variable m_condvar;
-    bool m_exit{false};
+    template <class Fn, class F>
+    void construct(F&& f, std::true_type /* inline */) {
+        static const Ops ops = {
+            [](void* s) { (*static_cast<Fn*>(s))(); },
+            [](void* dst, void* src) {
+                new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+                static_cast<Fn*>(src)->~Fn();
+            },
+            [](void* s) { static_cast<Fn*>(s)->~Fn(); }};
+        new (&m_storage) Fn(std::forward<F>(f));
+        m_ops = &ops;
+    }
+    template <class Fn, class F>
+    void construct(F&& f, std::false_type /* inline */) {
+        static const Ops ops = {
+            [](void* s) { (**static_cast<Fn**>(s))(); },
+            [](void* dst, void* src) {
+                *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+            },
+            [](void* s) { delete *static_cast<Fn**>(s); }};
+        *reinterpret_cast<Fn**>(&m_storage) = new Fn(std::forward<F>(f));
+        m_ops = &ops;
+    }
+    void move_from(Task& other) {
+        if (other.m_ops) {
+            other.m_ops->move(&m_storage, &other.m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type
+        m_storage;
+    const Ops* m_ops{nullptr};
 };
 
-inline void ThreadPool::add_thread(std::function<void()> initializer) {
-    m_threads.emplace_back([this, initializer] {
-        initializer();
-        for (;;) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_condvar.wait(lock,
-                               [this] { return m_exit || !m_tasks.empty(); });
-                if (m_exit && m_tasks.empty()) {
-                    return;
-                }
-                task = std::move(m_tasks.front());
-                m_tasks.pop();
-            }
-            task();
-        }
-    });
-}
+// Work-stealing pool.  Every worker has its own deque: it takes the most
+// recently queued task from its own, and steals the oldest one from the
+// others when it runs out.  Tasks queued from outside the pool are
+// spread over the deques.
+class ThreadPool {
+public:
+    ThreadPool() = default;
+    ~ThreadPool();
 
-inline void ThreadPool::initialize(const size_t threads) {
-    for (size_t i = 0; i < threads; i++) {
-        add_thread([]() {} /* null function */);
+    // Create the worker threads, optionally pinning each of them to
+    // its own core.  Only call this once.
+    void initialize(std::size_t threads, bool pin_threads = false);
+
+    void add_task(Task task);
+    // Whether the calling thread is a worker of this pool.
+    bool is_worker() const;
+    std::size_t size() const {
+        return m_threads.size();
     }
-}
 
-template <class F, class... Args>
-auto ThreadPool::add_task(F&& f, Args&&... args)
-    -> std::future<typename std::result_of<F(Args...)>::type> {
-    using return_type = typename std::result_of<F(Args...)>::type;
+private:
+    // Deque in a ring buffer that only grows, so it stops allocating
+    // once it has seen the largest number of queued tasks.
+    class WorkQueue {
+    public:
+        void push_back(Task&& task);
+        bool pop_back(Task& task);
+        bool pop_front(Task& task);
+        bool empty() const {
+            return m_size.load(std::memory_order_relaxed) == 0;
+        }
 
-    auto task = std::make_shared<std::packaged_task<return_type()>>(
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    private:
+        SMP::Mutex m_mutex;
+        std::vector<Task> m_ring;
+        std::size_t m_head{0};
+        std::atomic<std::size_t> m_size{0};
+    };
 
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_tasks.emplace([task]() { (*task)(); });
-    }
-    m_condvar.notify_one();
-    return res;
-}
+    void worker(std::size_t index);
+    bool find_task(std::size_t index, Task& task);
 
-inline ThreadPool::~ThreadPool() {
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_exit = true;
-    }
-    m_condvar.notify_all();
-    for (std::thread& worker : m_threads) {
-        worker.join();
-    }
-}
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<std::size_t> m_next_queue{0};
 
+    // Queued tasks, and workers sleeping until there are some.
+    std::atomic<std::size_t> m_pending{0};
+    std::atomic<std::size_t> m_sleeping{0};
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    bool m_exit{false};
+};
+
+// Tasks which can be waited for together.  Task exceptions are rethrown
+// from wait_all().
+//
+// The group keeps its tasks in its own queue, and only queues a task to
+// the pool which runs the next one of them.  A worker waiting for the
+// group can then run the group's tasks which haven't started yet, and
+// no other ones.
 class ThreadGroup {
 public:
-    ThreadGroup(ThreadPool& pool) : m_pool(pool) {}
+    ThreadGroup(ThreadPool& pool)
+        : m_pool(pool), m_sync(std::make_shared<Sync>()) {}
     template <class F, class... Args>
     void add_task(F&& f, Args&&... args) {
-        m_taskresults.emplace_back(
-            m_pool.add_task(std::forward<F>(f), std::forward<Args>(args)...));
+        {
+            std::lock_guard<std::mutex> lock(m_sync->mutex);
+            m_sync->pending++;
+            m_sync->queued.emplace_back(
+                std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        }
+        m_pool.add_task([sync = m_sync]() { run_queued(*sync); });
     }
     void wait_all() {
-        for (auto&& result : m_taskresults) {
-            result.get();
+        // A worker blocking here could be the one whose deque holds
+        // our tasks, so it runs them itself.
+        if (m_pool.is_worker()) {
+            while (run_queued(*m_sync)) {
+            }
+        }
+        std::unique_lock<std::mutex> lock(m_sync->mutex);
+        m_sync->condvar.wait(lock, [this] { return m_sync->pending == 0; });
+        if (m_sync->exception) {
+            std::rethrow_exception(std::exchange(m_sync->exception, nullptr));
         }
     }
 
 private:
+    // Shared with the queued tasks, which may outlive the group.
+    struct Sync {
+        std::mutex mutex;
+        std::condition_variable condvar;
+        std::deque<Task> queued;
+        std::size_t pending{0};
+        std::exception_ptr exception;
+    };
+
+    // Runs the oldest task which hasn't started.  Returns false if there
+    // is none.
+    static bool run_queued(Sync& sync) {
+        auto task = Task{};
+        {
+            std::lock_guard<std::mutex> lock(sync.mutex);
+            if (sync.queued.empty()) {
+                return false;
+            }
+            task = std::move(sync.queued.front());
+            sync.queued.pop_front();
+        }
+        auto exception = std::exception_ptr{};
+        try {
+            task();
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(sync.mutex);
+        if (exception && !sync.exception) {
+            sync.exception = exception;
+        }
+        if (--sync.pending == 0) {
+            sync.condvar.notify_all();
+        }
+        return true;
+    }
+
     ThreadPool& m_pool;
-    std::vector<std::future<void>> m_taskresults;
+    std::shared_ptr<Sync> m_sync;
 };
 
 }
@@ -29,7 +29,10 @@
 
 #include <algorithm>
 #include <bitset>
+#include <chrono>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <iterator>
@@ -53,7 +56,46 @@
 #include "string.h"
 #include "zlib.h"
 
-std::vector<TimeStep> Training::m_data{};
+thread_local std::vector<TimeStep> Training::m_data{};
+thread_local Training::SpillFile Training::m_spill{};
+
+namespace {
+    // Saves start with "v" and this version. Those without are version 1,
+    // whose steps have no full_search flag.
+    constexpr auto SAVE_VERSION = 2;
+
+    void read_step(std::istream& stream, TimeStep& timestep,
+                   const int version) {
+        int planes_size;
+        stream >> planes_size;
+        for (auto i = 0; i < planes_size; ++i) {
+            TimeStep::BoardPlane plane;
+            stream >> plane;
+            timestep.planes.push_back(plane);
+        }
+        int prob_size;
+        stream >> prob_size;
+        for (auto i = 0; i < prob_size; ++i) {
+            float prob;
+            stream >> prob;
+            timestep.probabilities.push_back(prob);
+        }
+        stream >> timestep.to_move;
+        stream >> timestep.net_winrate;
+        stream >> timestep.root_uct_winrate;
+        stream >> timestep.child_uct_winrate;
+        stream >> timestep.bestmove_visits;
+        if (version >= 2) {
+            stream >> timestep.full_search;
+        }
+    }
+
+    void append_le32(std::string& out, const std::uint32_t value) {
+        for (auto shift = 0; shift < 32; shift += 8) {
+            out.push_back(char((value >> shift) & 0xff));
+        }
+    }
+}
 
 std::ostream& operator<<(std::ostream& stream, const TimeStep& timestep) {
     stream << timestep.planes.size() << ' ';
@@ -68,30 +110,13 @@ std::ostream& operator<<(std::ostream& stream, const TimeStep& timestep) {
     stream << timestep.net_winrate << ' ';
     stream << timestep.root_uct_winrate << ' ';
     stream << timestep.child_uct_winrate << ' ';
-    stream << timestep.bestmove_visits << std::endl;
+    stream << timestep.bestmove_visits << ' ';
+    stream << timestep.full_search << std::endl;
     return stream;
 }
 
 std::istream& operator>>(std::istream& stream, TimeStep& timestep) {
-    int planes_size;
-    stream >> planes_size;
-    for (auto i = 0; i < planes_size; ++i) {
-        TimeStep::BoardPlane plane;
-        stream >> plane;
-        timestep.planes.push_back(plane);
-    }
-    int prob_size;
-    stream >> prob_size;
-    for (auto i = 0; i < prob_size; ++i) {
-        float prob;
-        stream >> prob;
-        timestep.probabilities.push_back(prob);
-    }
-    stream >> timestep.to_move;
-    stream >> timestep.net_winrate;
-    stream >> timestep.root_uct_winrate;
-    stream >> timestep.child_uct_winrate;
-    stream >> timestep.bestmove_visits;
+    read_step(stream, timestep, SAVE_VERSION);
     return stream;
 }
 
@@ -101,8 +126,11 @@ std::string OutputChunker::gen_chunk_name() const {
     return base;
 }
 
-OutputChunker::OutputChunker(const std::string& basename, bool compress)
-    : m_basename(basename), m_compress(compress) {}
+OutputChunker::OutputChunker(const std::string& basename, bool compress,
+                             const int level)
+    : m_basename(basename), m_compress(compress), m_level(level) {
+    assert(level >= 0 && level <= 9);
+}
 
 OutputChunker::~OutputChunker() {
     flush_chunks();
@@ -119,7 +147,8 @@ void OutputChunker::append(const std::string& str) {
 void OutputChunker::flush_chunks() {
     if (m_compress) {
         auto chunk_name = gen_chunk_name();
-        auto out = gzopen(chunk_name.c_str(), "wb9");
+        const auto mode = "wb" + std::to_string(m_level);
+        auto out = gzopen(chunk_name.c_str(), mode.c_str());
 
         auto in_buff_size = m_buffer.size();
         auto in_buff = std::make_unique<char[]>(in_buff_size);
@@ -146,6 +175,73 @@ void OutputChunker::flush_chunks() {
 
 void Training::clear_training() {
     Training::m_data.clear();
+    if (cfg_training_spill.empty()) {
+        m_spill.close();
+    } else {
+        m_spill.reset(cfg_training_spill);
+    }
+}
+
+Training::SpillFile::~SpillFile() {
+    close();
+}
+
+void Training::SpillFile::reset(const std::string& directory) {
+    out.close();
+    // A saved game keeps its file, so move on to a new one.
+    if (name.empty() || saved) {
+        // Processes seeded alike may share the directory.
+        const auto clock = static_cast<std::uint64_t>(
+            std::chrono::steady_clock::now().time_since_epoch().count());
+        auto unique = std::stringstream{};
+        unique << directory << "/leelaz_spill_" << std::hex
+               << (Random::get_Rng().randuint64() ^ clock) << ".txt";
+        name = unique.str();
+        saved = false;
+    }
+    out.open(name, std::ofstream::out | std::ofstream::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot write training spill file " + name);
+    }
+    steps = 0;
+}
+
+void Training::SpillFile::close() {
+    out.close();
+    if (!name.empty() && !saved) {
+        std::remove(name.c_str());
+    }
+    name.clear();
+    steps = 0;
+    saved = false;
+}
+
+void Training::add_step(const TimeStep& step) {
+    if (cfg_training_spill.empty()) {
+        m_data.emplace_back(step);
+        return;
+    }
+    if (!m_spill.out.is_open()) {
+        m_spill.reset(cfg_training_spill);
+    }
+    m_spill.out << step;
+    m_spill.steps++;
+}
+
+void Training::for_each_step(
+    const std::function<void(const TimeStep&)>& visit) {
+    for (const auto& step : m_data) {
+        visit(step);
+    }
+    if (m_spill.steps > 0) {
+        m_spill.out.flush();
+        auto in = std::ifstream{m_spill.name};
+        for (auto i = size_t{0}; i < m_spill.steps; i++) {
+            auto step = TimeStep{};
+            in >> step;
+            visit(step);
+        }
+    }
 }
 
 TimeStep::NNPlanes Training::get_planes(const GameState* const state) {
@@ -162,28 +258,30 @@ TimeStep::NNPlanes Training::get_planes(const GameState* const state) {
     return planes;
 }
 
-void Training::record(Network& network, const GameState& state,
-                      const UCTNode& root) {
+void Training::record(const GameState& state, const UCTNode& root,
+                      const bool full_search) {
     auto step = TimeStep{};
     step.to_move = state.board.get_to_move();
+    step.full_search = full_search;
     step.planes = get_planes(&state);
 
-    const auto result = network.get_output(&state, Network::Ensemble::DIRECT,
-                                           Network::IDENTITY_SYMMETRY);
-    step.net_winrate = result.winrate;
+    step.net_winrate = root.get_net_eval(step.to_move);
 
-    const auto& best_node = root.get_best_root_child(step.to_move);
+    // Use the statistics of the root's edges, a child shared through a
+    // transposition also counts the visits made through other parents.
+    const auto& children = root.get_children();
+    const auto best = root.get_best_root_child_index(step.to_move);
     step.root_uct_winrate = root.get_eval(step.to_move);
-    step.child_uct_winrate = best_node.get_eval(step.to_move);
-    step.bestmove_visits = best_node.get_visits();
+    step.child_uct_winrate = root.get_child_eval(best, step.to_move);
+    step.bestmove_visits = children.get_visits(best);
 
     step.probabilities.resize(POTENTIAL_MOVES);
 
     // Get total visit amount. We count rather
     // than trust the root to avoid ttable issues.
     auto sum_visits = 0.0;
-    for (const auto& child : root.get_children()) {
-        sum_visits += child->get_visits();
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        sum_visits += children.get_visits(i);
     }
 
     // In a terminal position (with 2 passes), we can have children, but we
@@ -194,9 +292,9 @@ void Training::record(Network& network, const GameState& state,
         return;
     }
 
-    for (const auto& child : root.get_children()) {
-        auto prob = static_cast<float>(child->get_visits() / sum_visits);
-        auto move = child->get_move();
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        auto prob = static_cast<float>(children.get_visits(i) / sum_visits);
+        auto move = children[i].get_move();
         if (move != FastBoard::PASS) {
             auto xy = state.board.get_xy(move);
             step.probabilities[xy.second * BOARD_SIZE + xy.first] = prob;
@@ -205,12 +303,12 @@ void Training::record(Network& network, const GameState& state,
         }
     }
 
-    m_data.emplace_back(step);
+    add_step(step);
 }
 
 void Training::dump_training(const int winner_color,
                              const std::string& filename) {
-    auto chunker = OutputChunker{filename, true};
+    auto chunker = OutputChunker{filename, true, cfg_training_compression};
     dump_training(winner_color, chunker);
 }
 
@@ -227,64 +325,164 @@ void Training::load_training(const std::string& filename) {
 }
 
 void Training::save_training(std::ofstream& out) {
+    out << 'v' << SAVE_VERSION << ' ';
+    if (m_spill.out.is_open()) {
+        // Only refer to the spill file. The save owns it from now on,
+        // and loading the save removes it.
+        assert(m_data.empty());
+        m_spill.out.flush();
+        m_spill.saved = true;
+        out << "spill " << m_spill.steps << ' ' << m_spill.name << std::endl;
+        return;
+    }
     out << m_data.size() << ' ';
     for (const auto& step : m_data) {
         out << step;
     }
 }
+
 void Training::load_training(std::ifstream& in) {
-    int steps;
-    in >> steps;
+    auto version = 1;
+    auto header = std::string{};
+    in >> header;
+    if (!header.empty() && header[0] == 'v') {
+        std::istringstream{header.substr(1)} >> version;
+        if (version > SAVE_VERSION) {
+            Utils::myprintf("Training data version %d is not supported.\n",
+                            version);
+            return;
+        }
+        in >> header;
+    }
+    if (header == "spill") {
+        auto steps = size_t{0};
+        auto name = std::string{};
+        in >> steps >> std::ws;
+        std::getline(in, name);
+        // This thread can still be appending to the file, so read all of
+        // it before adding the steps.
+        const auto own = name == m_spill.name;
+        if (own) {
+            m_spill.out.flush();
+        }
+        auto spill = std::ifstream{name};
+        auto loaded = std::vector<TimeStep>{};
+        while (loaded.size() < steps) {
+            TimeStep step;
+            read_step(spill, step, version);
+            if (!spill) {
+                break;
+            }
+            loaded.emplace_back(step);
+        }
+        spill.close();
+        for (const auto& step : loaded) {
+            add_step(step);
+        }
+        // The file belonged to the save, and is used up once loaded.
+        if (loaded.size() == steps) {
+            if (own) {
+                m_spill.saved = false;
+            } else {
+                std::remove(name.c_str());
+            }
+        }
+        return;
+    }
+    auto steps = 0;
+    std::istringstream{header} >> steps;
     for (auto i = 0; i < steps; ++i) {
         TimeStep step;
-        in >> step;
-        m_data.push_back(step);
+        read_step(in, step, version);
+        add_step(step);
     }
 }
 
 void Training::dump_training(const int winner_color, OutputChunker& outchunk) {
     auto training_str = std::string{};
-    for (const auto& step : m_data) {
-        auto out = std::stringstream{};
-        // First output 16 times an input feature plane
-        for (auto p = size_t{0}; p < 16; p++) {
-            const auto& plane = step.planes[p];
-            // Write it out as a string of hex characters
-            for (auto bit = size_t{0}; bit + 3 < plane.size(); bit += 4) {
-                auto hexbyte = plane[bit]     << 3
-                             | plane[bit + 1] << 2
-                             | plane[bit + 2] << 1
-                             | plane[bit + 3] << 0;
-                out << std::hex << hexbyte;
-            }
-            // NUM_INTERSECTIONS % 4 = 1 so the last bit goes by itself
-            // for odd sizes
-            assert(plane.size() % 4 == 1);
-            out << plane[plane.size() - 1];
-            out << std::dec << std::endl;
+    for_each_step([&](const TimeStep& step) {
+        if (cfg_binary_training) {
+            training_str.append(format_v2(step, winner_color));
+        } else {
+            training_str.append(format_text(step, winner_color));
         }
-        // The side to move planes can be compactly encoded into a single
-        // bit, 0 = black to move.
-        out << (step.to_move == FastBoard::BLACK ? "0" : "1") << std::endl;
-        // Then a POTENTIAL_MOVES long array of float probabilities
-        for (auto it = begin(step.probabilities); it != end(step.probabilities);
-             ++it) {
-            out << *it;
-            if (next(it) != end(step.probabilities)) {
-                out << " ";
-            }
+    });
+    outchunk.append(training_str);
+}
+
+std::string Training::format_text(const TimeStep& step,
+                                  const int winner_color) {
+    auto out = std::stringstream{};
+    // First output 16 times an input feature plane
+    for (auto p = size_t{0}; p < 16; p++) {
+        const auto& plane = step.planes[p];
+        // Write it out as a string of hex characters
+        for (auto bit = size_t{0}; bit + 3 < plane.size(); bit += 4) {
+            auto hexbyte = plane[bit]     << 3
+                         | plane[bit + 1] << 2
+                         | plane[bit + 2] << 1
+                         | plane[bit + 3] << 0;
+            out << std::hex << hexbyte;
         }
-        out << std::endl;
-        // And the game result for the side to move
-        if (step.to_move == winner_color) {
-            out << "1";
-        } else {
-            out << "-1";
+        // NUM_INTERSECTIONS % 4 = 1 so the last bit goes by itself
+        // for odd sizes
+        assert(plane.size() % 4 == 1);
+        out << plane[plane.size() - 1];
+        out << std::dec << std::endl;
+    }
+    // The side to move planes can be compactly encoded into a single
+    // bit, 0 = black to move.
+    out << (step.to_move == FastBoard::BLACK ? "0" : "1") << std::endl;
+    // Then a POTENTIAL_MOVES long array of float probabilities. The
+    // format has no room for a flag, so fast searches write all zeros,
+    // which add nothing to the policy loss.
+    for (auto it = begin(step.probabilities); it != end(step.probabilities);
+         ++it) {
+        out << (step.full_search ? *it : 0.0f);
+        if (next(it) != end(step.probabilities)) {
+            out << " ";
         }
-        out << std::endl;
-        training_str.append(out.str());
     }
-    outchunk.append(training_str);
+    out << std::endl;
+    // And the game result for the side to move
+    if (step.to_move == winner_color) {
+        out << "1";
+    } else {
+        out << "-1";
+    }
+    out << std::endl;
+    return out.str();
+}
+
+std::string Training::format_v2(const TimeStep& step, const int winner_color) {
+    auto out = std::string{};
+    // int32 version, always 1
+    append_le32(out, 1);
+    // POTENTIAL_MOVES float32 probabilities, zero for fast searches as in
+    // the text format
+    static_assert(sizeof(float) == sizeof(std::uint32_t), "float32 expected");
+    for (const auto prob : step.probabilities) {
+        const auto value = step.full_search ? prob : 0.0f;
+        auto bits = std::uint32_t{};
+        std::memcpy(&bits, &value, sizeof(bits));
+        append_le32(out, bits);
+    }
+    // The 16 input planes as one bit string, most significant bit first
+    auto packed = std::string((16 * NUM_INTERSECTIONS + 7) / 8, '\0');
+    for (auto p = size_t{0}; p < 16; p++) {
+        const auto& plane = step.planes[p];
+        for (auto bit = size_t{0}; bit < plane.size(); bit++) {
+            if (plane[bit]) {
+                const auto index = p * NUM_INTERSECTIONS + bit;
+                packed[index / 8] |= char(0x80 >> (index % 8));
+            }
+        }
+    }
+    out.append(packed);
+    // uint8 side to move, 0 = black, and uint8 1 if it won, 0 otherwise
+    out.push_back(char(step.to_move == FastBoard::BLACK ? 0 : 1));
+    out.push_back(char(step.to_move == winner_color ? 1 : 0));
+    return out;
 }
 
 void Training::dump_debug(const std::string& filename) {
@@ -296,18 +494,23 @@ void Training::dump_debug(OutputChunker& outchunk) {
     auto debug_str = std::string{};
     {
         auto out = std::stringstream{};
-        out << "2" << std::endl; // File format version
+        // File format version. Since version 3, net_winrate is the eval
+        // under the random symmetry which expanded the root, rather than
+        // under the identity symmetry.
+        out << "3" << std::endl;
         out << cfg_resignpct << " " << cfg_weightsfile << std::endl;
         debug_str.append(out.str());
     }
-    for (const auto& step : m_data) {
+    // One line per move:
+    // net_winrate root_uct_winrate child_uct_winrate bestmove_visits
+    for_each_step([&](const TimeStep& step) {
         auto out = std::stringstream{};
         out << step.net_winrate
             << " " << step.root_uct_winrate
             << " " << step.child_uct_winrate
             << " " << step.bestmove_visits << std::endl;
         debug_str.append(out.str());
-    }
+    });
     outchunk.append(debug_str);
 }
 
@@ -347,7 +550,7 @@ void Training::process_game(GameState& state, size_t& train_pos,
         step.probabilities[move_idx] = 1.0f;
 
         train_pos++;
-        m_data.emplace_back(step);
+        add_step(step);
 
         counter++;
     } while (state.forward_move() && counter < tree_moves.size());
@@ -34,6 +34,8 @@
 
 #include <bitset>
 #include <cstddef>
+#include <fstream>
+#include <functional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -49,10 +51,15 @@ public:
     NNPlanes planes;
     std::vector<float> probabilities;
     int to_move;
+    // Raw network eval of the root, under the random symmetry which
+    // expanded it.
     float net_winrate;
     float root_uct_winrate;
     float child_uct_winrate;
     int bestmove_visits;
+    // False for the fast searches of playout cap randomization, whose
+    // visits are not a policy target.
+    bool full_search{true};
 };
 
 std::ostream& operator<<(std::ostream& stream, const TimeStep& timestep);
@@ -60,7 +67,9 @@ std::istream& operator>>(std::istream& stream, TimeStep& timestep);
 
 class OutputChunker {
 public:
-    OutputChunker(const std::string& basename, bool compress = false);
+    // Compressed chunks are gzip files written with the given level, 0-9.
+    OutputChunker(const std::string& basename, bool compress = false,
+                  int level = 9);
     ~OutputChunker();
     void append(const std::string& str);
 
@@ -75,16 +84,28 @@ private:
     std::string m_buffer;
     std::string m_basename;
     bool m_compress{false};
+    int m_level{9};
 };
 
+// Every thread records its own game, so that the games played at once by
+// SelfPlay don't mix. With cfg_training_spill, the samples are appended to
+// a spill file in that directory instead of being kept in memory, and
+// save_training() only writes a reference to that file. The file then
+// belongs to the save, load_training() removes it once it is read back.
 class Training {
 public:
     static void clear_training();
     static void dump_training(int winner_color,
                               const std::string& out_filename);
+    // Writes the text (v1) format, or the binary v2 format of
+    // training/tf/chunkparser.py with cfg_binary_training.
+    static void dump_training(int winner_color, OutputChunker& outchunker);
     static void dump_debug(const std::string& out_filename);
-    static void record(Network& network, const GameState& state,
-                       const UCTNode& node);
+    // The network eval comes from the root node, so recording a move
+    // doesn't cost an evaluation. Nodes don't keep the symmetry of their
+    // evaluation, so it is whichever random symmetry expanded the root.
+    static void record(const GameState& state, const UCTNode& node,
+                       bool full_search = true);
 
     static void dump_supervised(const std::string& sgf_file,
                                 const std::string& out_filename);
@@ -96,11 +117,30 @@ private:
     static void process_game(GameState& state, size_t& train_pos, int who_won,
                              const std::vector<int>& tree_moves,
                              OutputChunker& outchunker);
-    static void dump_training(int winner_color, OutputChunker& outchunker);
     static void dump_debug(OutputChunker& outchunker);
+    static std::string format_text(const TimeStep& step, int winner_color);
+    static std::string format_v2(const TimeStep& step, int winner_color);
     static void save_training(std::ofstream& out);
     static void load_training(std::ifstream& in);
-    static std::vector<TimeStep> m_data;
+    static void add_step(const TimeStep& step);
+    static void for_each_step(
+        const std::function<void(const TimeStep&)>& visit);
+
+    struct SpillFile {
+        ~SpillFile();
+        // Start a new, empty file. The old one is removed unless a saved
+        // game still refers to it.
+        void reset(const std::string& directory);
+        // Close the file, and remove it unless it was saved.
+        void close();
+        std::string name;
+        std::ofstream out;
+        size_t steps{0};
+        bool saved{false};
+    };
+
+    static thread_local std::vector<TimeStep> m_data;
+    static thread_local SpillFile m_spill;
 };
 
 #endif
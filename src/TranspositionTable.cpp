@@ -0,0 +1,122 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "TranspositionTable.h"
+
+#include "UCTNode.h"
+#include "UCTNodePointer.h"
+
+TranspositionTable::~TranspositionTable() {
+    reset(0);
+}
+
+void TranspositionTable::reset(const size_t max_bytes) {
+    clear();
+
+    // Power of two, so that the hash can be masked.
+    auto entries = size_t{0};
+    if (max_bytes >= sizeof(Entry)) {
+        entries = 1;
+        while (2 * entries * sizeof(Entry) <= max_bytes) {
+            entries *= 2;
+        }
+    }
+    if (entries == m_entries.size()) {
+        return;
+    }
+
+    UCTNodePointer::decrement_tree_size(m_entries.size() * sizeof(Entry));
+    m_entries = std::vector<Entry>(entries);
+    m_entries.shrink_to_fit();
+    UCTNodePointer::increment_tree_size(m_entries.size() * sizeof(Entry));
+}
+
+void TranspositionTable::clear() {
+    for (auto& entry : m_entries) {
+        if (entry.node) {
+            UCTNodePointer::drop_table_reference(entry.node);
+        }
+        entry = Entry{};
+    }
+    m_links = 0;
+}
+
+void TranspositionTable::inflate(const UCTNodePointer& child,
+                                 const std::uint64_t hash) {
+    if (!enabled() || child.is_inflated()) {
+        child.inflate();
+        return;
+    }
+
+    const auto index = hash & (m_entries.size() - 1);
+    auto& entry = m_entries[index];
+
+    auto node = static_cast<UCTNode*>(nullptr);
+    {
+        LOCK(m_locks[index % NUM_LOCKS], lock);
+        // A node knows the move into it, so only parents which play the
+        // same move can share it.
+        if (entry.node && entry.hash == hash && entry.node->valid()
+            && entry.node->get_move() == child.get_move()) {
+            node = entry.node;
+            node->add_ref();
+        }
+    }
+    if (node) {
+        if (child.link(node)) {
+            m_links++;
+        } else {
+            // Someone else inflated the child first.
+            UCTNodePointer::drop_reference(node);
+        }
+        return;
+    }
+
+    child.inflate();
+    node = child.get();
+    auto replaced = static_cast<UCTNode*>(nullptr);
+    {
+        LOCK(m_locks[index % NUM_LOCKS], lock);
+        if (entry.node != node) {
+            node->add_table_ref();
+            replaced = entry.node;
+            entry.hash = hash;
+            entry.node = node;
+        }
+    }
+    if (replaced) {
+        UCTNodePointer::drop_table_reference(replaced);
+    }
+}
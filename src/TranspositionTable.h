@@ -0,0 +1,89 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef TRANSPOSITIONTABLE_H_INCLUDED
+#define TRANSPOSITIONTABLE_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "SMP.h"
+
+class UCTNode;
+class UCTNodePointer;
+
+// Maps positions, by their FullBoard hash (which includes the ko square,
+// side to move and passes), to search tree nodes. Children that transpose
+// into a position already in the table, with the same last move, share
+// its node, which turns the tree into a DAG. The parent's edge statistics
+// keep the visits made through each parent.
+//
+// The table holds a reference to every node in it. It is emptied before
+// every search, so it never keeps discarded parts of the tree alive.
+class TranspositionTable {
+public:
+    TranspositionTable() = default;
+    ~TranspositionTable();
+
+    // Drop all entries and resize the table to use at most max_bytes,
+    // which is accounted as part of the tree. 0 disables the table.
+    void reset(size_t max_bytes);
+    bool enabled() const {
+        return !m_entries.empty();
+    }
+
+    // Inflate child, sharing the node of a transposition when there
+    // is one. hash is that of the position after the child's move.
+    void inflate(const UCTNodePointer& child, std::uint64_t hash);
+
+    // Number of children that were linked to an existing node.
+    size_t get_links() const {
+        return m_links;
+    }
+
+private:
+    struct Entry {
+        std::uint64_t hash{0};
+        UCTNode* node{nullptr};
+    };
+    static constexpr size_t NUM_LOCKS = 256;
+
+    void clear();
+
+    std::vector<Entry> m_entries;
+    std::array<SMP::Mutex, NUM_LOCKS> m_locks;
+    std::atomic<size_t> m_links{0};
+};
+
+#endif
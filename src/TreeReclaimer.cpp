@@ -0,0 +1,116 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "TreeReclaimer.h"
+
+#include "UCTNode.h"
+
+namespace {
+    // Nodes a thread takes from the shared stack at once.
+    constexpr size_t RECLAIM_TAKE = 16;
+}
+
+TreeReclaimer::~TreeReclaimer() {
+    reclaim_all();
+}
+
+void TreeReclaimer::add(UCTNodePointer::Root root) {
+    if (!root) {
+        return;
+    }
+    // The old root can still be a node of the new tree, or of another
+    // pending one, if it was reached through a transposition.
+    const auto node = root.release();
+    if (!UCTNodePointer::release_root(node)) {
+        return;
+    }
+    LOCK(m_mutex, lock);
+    m_pending.push_back(node);
+    m_pending_count = m_pending.size();
+}
+
+size_t TreeReclaimer::reclaim(const size_t max_nodes) {
+    if (empty()) {
+        return 0;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    auto stack = std::vector<UCTNode*>{};
+    {
+        LOCK(m_mutex, lock);
+        const auto take = std::min(RECLAIM_TAKE, m_pending.size());
+        stack.assign(std::end(m_pending) - take, std::end(m_pending));
+        m_pending.resize(m_pending.size() - take);
+        m_pending_count = m_pending.size();
+    }
+
+    auto deleted = size_t{0};
+    auto pointers = size_t{0};
+    while (!stack.empty() && deleted < max_nodes) {
+        const auto node = stack.back();
+        stack.pop_back();
+        pointers += node->detach_children(stack);
+        delete node;
+        deleted++;
+    }
+
+    if (!stack.empty()) {
+        LOCK(m_mutex, lock);
+        m_pending.insert(std::end(m_pending), std::begin(stack),
+                         std::end(stack));
+        m_pending_count = m_pending.size();
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+    m_stats.nodes += deleted;
+    m_stats.reclaim_ns += elapsed.count();
+    return pointers;
+}
+
+size_t TreeReclaimer::reclaim_all() {
+    auto pointers = size_t{0};
+    while (!empty()) {
+        pointers += reclaim(SIZE_MAX);
+    }
+    return pointers;
+}
+
+void TreeReclaimer::reset_stats() {
+    m_stats.nodes = 0;
+    m_stats.reclaim_ns = 0;
+}
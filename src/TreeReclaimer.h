@@ -0,0 +1,87 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef TREERECLAIMER_H_INCLUDED
+#define TREERECLAIMER_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "SMP.h"
+#include "UCTNodePointer.h"
+
+class UCTNode;
+
+// Deletes discarded search trees a slice at a time, without recursion.
+// The search threads take slices between their playouts, so that dropping
+// a large tree is shared by all of them, and neither delays the next
+// search nor ties up a thread of its own.
+//
+// Pending nodes are deleted depth first, which bounds the memory needed
+// to remember them by the depth of the tree times the number of moves.
+class TreeReclaimer {
+public:
+    TreeReclaimer() = default;
+    ~TreeReclaimer();
+
+    // Drop the reference to an old root. The node is only queued if that
+    // was the last one, other trees can still share it.
+    void add(UCTNodePointer::Root root);
+    // Delete up to max_nodes nodes. Returns the number of child pointers
+    // which went with them.
+    size_t reclaim(size_t max_nodes);
+    // Delete everything, only while no other thread is reclaiming.
+    size_t reclaim_all();
+    bool empty() const {
+        return m_pending_count.load(std::memory_order_relaxed) == 0;
+    }
+
+    // Nodes deleted, and the time it took all threads together.
+    struct Stats {
+        std::atomic<std::int64_t> nodes{0};
+        std::atomic<std::int64_t> reclaim_ns{0};
+    };
+    const Stats& get_stats() const {
+        return m_stats;
+    }
+    void reset_stats();
+
+private:
+    SMP::Mutex m_mutex;
+    std::vector<UCTNode*> m_pending;
+    std::atomic<size_t> m_pending_count{0};
+    Stats m_stats;
+};
+
+#endif
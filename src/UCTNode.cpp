@@ -30,14 +30,20 @@
 #include "config.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <numeric>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -52,6 +58,27 @@
 
 using namespace Utils;
 
+namespace {
+// Added to m_refs for the transposition table's reference. A node is in
+// at most one table entry, the one for its position.
+constexpr auto TABLE_REF = std::uint32_t{1} << 31;
+
+// Winrate for tomove, counting virtual_loss extra losses for it.
+float calc_eval(double blackeval, const int visits, const int virtual_loss,
+                const int tomove) {
+    const auto total_visits = visits + virtual_loss;
+    assert(total_visits > 0);
+    if (tomove == FastBoard::WHITE) {
+        blackeval += static_cast<double>(virtual_loss);
+    }
+    auto eval = static_cast<float>(blackeval / double(total_visits));
+    if (tomove == FastBoard::WHITE) {
+        eval = 1.0f - eval;
+    }
+    return eval;
+}
+}
+
 UCTNode::UCTNode(const int vertex, const float policy)
     : m_move(vertex), m_policy(policy) {}
 
@@ -60,15 +87,36 @@ bool UCTNode::first_visit() const {
 }
 
 bool UCTNode::create_children(Network& network, std::atomic<int>& nodecount,
-                              const GameState& state, float& eval,
-                              const float min_psa_ratio) {
+                              const SearchState& state, float& eval,
+                              const float min_psa_ratio,
+                              const std::uint16_t generation) {
+    if (!begin_expansion(state, min_psa_ratio, generation)) {
+        return false;
+    }
+
+    NNCache::Netresult raw_netlist;
+    try {
+        raw_netlist =
+            network.get_output(&state, Network::Ensemble::RANDOM_SYMMETRY);
+    } catch (NetworkHaltException&) {
+        expand_cancel();
+        throw;
+    }
+
+    finish_expansion(nodecount, state, raw_netlist, eval, min_psa_ratio);
+    return true;
+}
+
+bool UCTNode::begin_expansion(const SearchState& state,
+                              const float min_psa_ratio,
+                              const std::uint16_t generation) {
     // no successors in final state
     if (state.get_passes() >= 2) {
         return false;
     }
 
     // acquire the lock
-    if (!acquire_expanding()) {
+    if (!acquire_expanding(generation)) {
         return false;
     }
 
@@ -77,16 +125,17 @@ bool UCTNode::create_children(Network& network, std::atomic<int>& nodecount,
         expand_done();
         return false;
     }
+    return true;
+}
 
-    NNCache::Netresult raw_netlist;
-    try {
-        raw_netlist =
-            network.get_output(&state, Network::Ensemble::RANDOM_SYMMETRY);
-    } catch (NetworkHaltException&) {
-        expand_cancel();
-        throw;
-    }
+void UCTNode::cancel_expansion() {
+    expand_cancel();
+}
 
+void UCTNode::finish_expansion(std::atomic<int>& nodecount,
+                               const SearchState& state,
+                               const Network::Netresult& raw_netlist,
+                               float& eval, const float min_psa_ratio) {
     // DCNN returns winrate as side to move
     const auto stm_eval = raw_netlist.winrate;
     const auto to_move = state.board.get_to_move();
@@ -147,13 +196,16 @@ bool UCTNode::create_children(Network& network, std::atomic<int>& nodecount,
         }
     }
 
+    // Count the visit of the evaluation, unless the node is only being
+    // widened. A node collapsed by collapse_cold() already has visits,
+    // and the edge from its parent counts this one too.
+    const auto had_children = has_children();
     link_nodelist(nodecount, nodelist, min_psa_ratio);
-    if (first_visit()) {
+    if (!had_children) {
         // Increment visit and assign eval.
         update(eval);
     }
     expand_done();
-    return true;
 }
 
 void UCTNode::link_nodelist(std::atomic<int>& nodecount,
@@ -192,7 +244,7 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
     m_min_psa_ratio_children = skipped_children ? min_psa_ratio : 0.0f;
 }
 
-const std::vector<UCTNodePointer>& UCTNode::get_children() const {
+const UCTNodeChildren& UCTNode::get_children() const {
     return m_children;
 }
 
@@ -267,18 +319,31 @@ float UCTNode::get_eval_lcb(const int color) const {
     return mean - z * stddev;
 }
 
-float UCTNode::get_raw_eval(const int tomove, const int virtual_loss) const {
-    auto visits = get_visits() + virtual_loss;
-    assert(visits > 0);
-    auto blackeval = get_blackevals();
-    if (tomove == FastBoard::WHITE) {
-        blackeval += static_cast<double>(virtual_loss);
-    }
-    auto eval = static_cast<float>(blackeval / double(visits));
-    if (tomove == FastBoard::WHITE) {
-        eval = 1.0f - eval;
+float UCTNode::get_child_eval(const size_t index, const int tomove) const {
+    return calc_eval(m_children.get_blackevals(index),
+                     m_children.get_visits(index), 0, tomove);
+}
+
+float UCTNode::get_child_eval_lcb(const size_t index, const int color) const {
+    // Like get_eval_lcb(), with the variance of the child node, which may
+    // also count visits through other parents.
+    auto visits = m_children.get_visits(index);
+    if (visits < 2) {
+        return -1e6f + visits;
     }
-    return eval;
+    auto mean = get_child_eval(index, color);
+
+    const auto& child = m_children[index];
+    auto variance =
+        child.is_inflated() ? child->get_eval_variance(1.0f) : 1.0f;
+    auto stddev = std::sqrt(variance / visits);
+    auto z = cached_t_quantile(visits - 1);
+
+    return mean - z * stddev;
+}
+
+float UCTNode::get_raw_eval(const int tomove, const int virtual_loss) const {
+    return calc_eval(get_blackevals(), get_visits(), virtual_loss, tomove);
 }
 
 float UCTNode::get_eval(const int tomove) const {
@@ -303,75 +368,108 @@ void UCTNode::accumulate_eval(const float eval) {
     atomic_add(m_blackevals, double(eval));
 }
 
-UCTNode* UCTNode::uct_select_child(const int color, const bool is_root) {
+size_t UCTNode::uct_select_child(const int color, const bool is_root) {
     wait_expanded();
 
-    // Count parentvisits manually to avoid issues with transpositions.
-    auto total_visited_policy = 0.0f;
-    auto parentvisits = size_t{0};
-    for (const auto& child : m_children) {
-        if (child.valid()) {
-            parentvisits += child.get_visits();
-            if (child.get_visits() > 0) {
-                total_visited_policy += child.get_policy();
-            }
-        }
-    }
-
-    const auto numerator = std::sqrt(
-        double(parentvisits)
-        * std::log(cfg_logpuct * double(parentvisits) + cfg_logconst));
+    // Only the edge statistics in m_children are used, so that scoring
+    // doesn't have to visit every child node.
+    const auto child_count = m_children.size();
+    m_children.touch();
+
+    // Use the visits through the children rather than our own, which
+    // differ with transpositions. They are totalled as the children
+    // are updated, so this is the only pass over them.
+    const auto parentvisits = double(m_children.get_total_visits());
+    const auto total_visited_policy = m_children.get_visited_policy();
+
+    const auto puct_scale =
+        cfg_puct
+        * std::sqrt(parentvisits
+                    * std::log(cfg_logpuct * parentvisits + cfg_logconst));
     const auto fpu_reduction =
         (is_root ? cfg_fpu_root_reduction : cfg_fpu_reduction)
         * std::sqrt(total_visited_policy);
     // Estimated eval for unknown nodes = parent (not NN) eval - reduction
     const auto fpu_eval = get_raw_eval(color) - fpu_reduction;
 
-    auto best = static_cast<UCTNodePointer*>(nullptr);
+    auto best = child_count;
     auto best_value = std::numeric_limits<double>::lowest();
 
-    for (auto& child : m_children) {
-        if (!child.active()) {
+    for (auto i = size_t{0}; i < child_count; i++) {
+        if (m_children.get_state(i) != UCTNodeChildren::ACTIVE) {
             continue;
         }
 
+        const auto visits = m_children.get_visits(i);
+        const auto virtual_loss = m_children.get_virtual_loss(i);
         auto winrate = fpu_eval;
-        if (child.is_inflated()
-            && child->m_expand_state.load() == ExpandState::EXPANDING) {
+        if (visits > 0) {
+            winrate = calc_eval(m_children.get_blackevals(i), visits,
+                                virtual_loss, color);
+        } else if (virtual_loss > 0) {
             // Someone else is expanding this node, never select it
             // if we can avoid so, because we'd block on it.
             winrate = -1.0f - fpu_reduction;
-        } else if (child.get_visits() > 0) {
-            winrate = child.get_eval(color);
         }
-        const auto psa = child.get_policy();
-        const auto denom = 1.0 + child.get_visits();
-        const auto puct = cfg_puct * psa * (numerator / denom);
+        const auto psa = m_children.get_policy(i);
+        const auto puct = puct_scale * psa / (1.0 + visits);
         const auto value = winrate + puct;
         assert(value > std::numeric_limits<double>::lowest());
 
         if (value > best_value) {
             best_value = value;
-            best = &child;
+            best = i;
         }
     }
 
-    assert(best != nullptr);
-    best->inflate();
-    return best->get();
+    assert(best < child_count);
+    m_children.virtual_loss(best, VIRTUAL_LOSS_COUNT);
+    return best;
+}
+
+void UCTNode::child_virtual_loss_undo(const size_t index) {
+    m_children.virtual_loss_undo(index, VIRTUAL_LOSS_COUNT);
+}
+
+void UCTNode::update_child(const size_t index, const float eval) {
+    m_children.update(index, eval);
+}
+
+void UCTNode::invalidate_child(const size_t index) {
+    auto& child = m_children[index];
+    child.inflate();
+    // A shared node may be valid when reached through another parent.
+    if (!child->is_shared()) {
+        child->invalidate();
+    }
+    m_children.set_state(index, UCTNodeChildren::INVALID);
+}
+
+void UCTNode::set_child_active(const size_t index, const bool active) {
+    auto& child = m_children[index];
+    if (child.is_inflated()) {
+        child->set_active(active);
+    }
+    if (m_children.get_state(index) != UCTNodeChildren::INVALID) {
+        m_children.set_state(index, active ? UCTNodeChildren::ACTIVE
+                                           : UCTNodeChildren::PRUNED);
+    }
 }
 
-class NodeComp
-    : public std::binary_function<UCTNodePointer&, UCTNodePointer&, bool> {
+// Compares the children of a node by the statistics of their edges, which
+// only count the visits made through that node.
+class NodeComp {
 public:
-    NodeComp(const int color, const float lcb_min_visits)
-        : m_color(color), m_lcb_min_visits(lcb_min_visits) {}
+    NodeComp(const UCTNode& parent, const int color,
+             const float lcb_min_visits)
+        : m_parent(parent), m_color(color), m_lcb_min_visits(lcb_min_visits) {}
 
     // WARNING : on very unusual cases this can be called on multithread
     // contexts (e.g., UCTSearch::get_pv()) so beware of race conditions
-    bool operator()(const UCTNodePointer& a, const UCTNodePointer& b) {
-        auto a_visit = a.get_visits();
-        auto b_visit = b.get_visits();
+    bool operator()(const size_t a, const size_t b) {
+        const auto& children = m_parent.get_children();
+        auto a_visit = children.get_visits(a);
+        auto b_visit = children.get_visits(b);
 
         // Need at least 2 visits for LCB.
         if (m_lcb_min_visits < 2) {
@@ -380,8 +478,8 @@ public:
 
         // Calculate the lower confidence bound for each node.
         if ((a_visit > m_lcb_min_visits) && (b_visit > m_lcb_min_visits)) {
-            auto a_lcb = a.get_eval_lcb(m_color);
-            auto b_lcb = b.get_eval_lcb(m_color);
+            auto a_lcb = m_parent.get_child_eval_lcb(a, m_color);
+            auto b_lcb = m_parent.get_child_eval_lcb(b, m_color);
 
             // Sort on lower confidence bounds
             if (a_lcb != b_lcb) {
@@ -396,55 +494,161 @@ public:
 
         // neither has visits, sort on policy prior
         if (a_visit == 0) {
-            return a.get_policy() < b.get_policy();
+            return children.get_policy(a) < children.get_policy(b);
         }
 
         // both have same non-zero number of visits
-        return a.get_eval(m_color) < b.get_eval(m_color);
+        return m_parent.get_child_eval(a, m_color)
+               < m_parent.get_child_eval(b, m_color);
     }
 
 private:
+    const UCTNode& m_parent;
     int m_color;
     float m_lcb_min_visits;
 };
 
 void UCTNode::sort_children(const int color, const float lcb_min_visits) {
-    std::stable_sort(rbegin(m_children), rend(m_children),
-                     NodeComp(color, lcb_min_visits));
+    m_children.sort_reverse(NodeComp(*this, color, lcb_min_visits));
 }
 
-UCTNode& UCTNode::get_best_root_child(const int color) const {
+int UCTNode::get_max_child_visits() const {
+    auto max_visits = 0;
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        max_visits = std::max(max_visits, m_children.get_visits(i));
+    }
+    return max_visits;
+}
+
+size_t UCTNode::get_best_root_child_index(const int color) const {
     wait_expanded();
 
     assert(!m_children.empty());
 
-    auto max_visits = 0;
-    for (const auto& node : m_children) {
-        max_visits = std::max(max_visits, node.get_visits());
+    const auto lcb_min_visits =
+        cfg_lcb_min_visit_ratio * get_max_child_visits();
+    auto comp = NodeComp(*this, color, lcb_min_visits);
+    auto best = size_t{0};
+    for (auto i = size_t{1}; i < m_children.size(); i++) {
+        if (comp(best, i)) {
+            best = i;
+        }
     }
+    return best;
+}
 
-    auto ret =
-        std::max_element(begin(m_children), end(m_children),
-                         NodeComp(color, cfg_lcb_min_visit_ratio * max_visits));
-    ret->inflate();
+UCTNode& UCTNode::get_best_root_child(const int color) const {
+    const auto& best = m_children[get_best_root_child_index(color)];
+    best.inflate();
+
+    return *best.get();
+}
 
-    return *(ret->get());
+size_t UCTNode::count_nodes() const {
+    auto shared_seen = std::unordered_set<const UCTNode*>{};
+    return count_nodes(shared_seen);
 }
 
-size_t UCTNode::count_nodes_and_clear_expand_state() {
+size_t UCTNode::count_nodes(
+    std::unordered_set<const UCTNode*>& shared_seen) const {
     auto nodecount = size_t{0};
     nodecount += m_children.size();
-    if (expandable()) {
-        m_expand_state = ExpandState::INITIAL;
+    for (const auto& child : m_children) {
+        if (child.is_inflated()) {
+            // Visit shared subtrees only once.
+            if (child->is_shared() && !shared_seen.insert(child.get()).second) {
+                continue;
+            }
+            nodecount += child->count_nodes(shared_seen);
+        }
     }
+    return nodecount;
+}
+
+size_t UCTNode::detach_children(std::vector<UCTNode*>& detached) {
+    const auto nodecount = m_children.size();
     for (auto& child : m_children) {
-        if (child.is_inflated()) {
-            nodecount += child->count_nodes_and_clear_expand_state();
+        if (const auto node = child.release_reference()) {
+            detached.push_back(node);
         }
     }
+    m_children.clear();
     return nodecount;
 }
 
+void UCTNode::cold_memory(std::map<std::uint32_t, size_t>& memory) const {
+    auto shared_seen = std::unordered_set<const UCTNode*>{};
+    cold_memory(memory, shared_seen);
+}
+
+void UCTNode::cold_memory(
+    std::map<std::uint32_t, size_t>& memory,
+    std::unordered_set<const UCTNode*>& shared_seen) const {
+    for (const auto& child : m_children) {
+        if (!child.is_inflated() || child->m_children.empty()
+            || (child->is_shared()
+                && !shared_seen.insert(child.get()).second)) {
+            continue;
+        }
+        const auto& grandchildren = child->m_children;
+        auto size = grandchildren.memory_used();
+        for (const auto& grandchild : grandchildren) {
+            if (grandchild.is_inflated()) {
+                size += sizeof(UCTNode);
+            }
+        }
+        memory[grandchildren.last_touched()] += size;
+        child->cold_memory(memory, shared_seen);
+    }
+}
+
+size_t UCTNode::collapse_cold(const std::uint32_t epoch) {
+    auto shared_seen = std::unordered_set<const UCTNode*>{};
+    return collapse_cold(epoch, shared_seen);
+}
+
+size_t UCTNode::collapse_cold(const std::uint32_t epoch,
+                              std::unordered_set<const UCTNode*>& shared_seen) {
+    auto dropped = size_t{0};
+    for (auto& child : m_children) {
+        if (!child.is_inflated() || child->m_children.empty()
+            || (child->is_shared()
+                && !shared_seen.insert(child.get()).second)) {
+            continue;
+        }
+        if (child->m_children.last_touched() < epoch) {
+            dropped += child->count_nodes();
+            child->m_children.clear();
+            child->m_min_psa_ratio_children = 2.0f;
+            child->m_expand_state = ExpandState::INITIAL;
+        } else {
+            dropped += child->collapse_cold(epoch, shared_seen);
+        }
+    }
+    return dropped;
+}
+
+void UCTNode::add_ref() {
+    m_refs++;
+}
+
+bool UCTNode::release_ref() {
+    return --m_refs == 0;
+}
+
+void UCTNode::add_table_ref() {
+    assert((m_refs.load() & TABLE_REF) == 0);
+    m_refs += TABLE_REF;
+}
+
+bool UCTNode::release_table_ref() {
+    return (m_refs -= TABLE_REF) == 0;
+}
+
+bool UCTNode::is_shared() const {
+    return (m_refs.load() & ~TABLE_REF) > 1;
+}
+
 void UCTNode::invalidate() {
     m_status = INVALID;
 }
@@ -463,10 +667,20 @@ bool UCTNode::active() const {
     return m_status == ACTIVE;
 }
 
-bool UCTNode::acquire_expanding() {
+bool UCTNode::acquire_expanding(const std::uint16_t generation) {
     auto expected = ExpandState::INITIAL;
     auto newval = ExpandState::EXPANDING;
-    return m_expand_state.compare_exchange_strong(expected, newval);
+    if (!m_expand_state.compare_exchange_strong(expected, newval)) {
+        // Nodes expanded by an earlier search may add the children
+        // they skipped.
+        if (expected != ExpandState::EXPANDED
+            || m_expand_generation.load() == generation
+            || !m_expand_state.compare_exchange_strong(expected, newval)) {
+            return false;
+        }
+    }
+    m_expand_generation = generation;
+    return true;
 }
 
 void UCTNode::expand_done() {
@@ -475,6 +689,7 @@ void UCTNode::expand_done() {
     (void)v;
 #endif
     assert(v == ExpandState::EXPANDING);
+    wake_expansion_waiters();
 }
 void UCTNode::expand_cancel() {
     auto v = m_expand_state.exchange(ExpandState::INITIAL);
@@ -482,12 +697,87 @@ void UCTNode::expand_cancel() {
     (void)v;
 #endif
     assert(v == ExpandState::EXPANDING);
+    wake_expansion_waiters();
 }
 void UCTNode::wait_expanded() const {
-    while (m_expand_state.load() == ExpandState::EXPANDING) {}
+    if (m_expand_state.load() == ExpandState::EXPANDING) {
+        wait_expansion();
+    }
     auto v = m_expand_state.load();
 #ifdef NDEBUG
     (void)v;
 #endif
     assert(v == ExpandState::EXPANDED);
 }
+
+namespace {
+    // Threads waiting for an expansion sleep on one of these, chosen
+    // by the address of the node.
+    struct alignas(64) ExpansionWaitStripe {
+        std::mutex mutex;
+        std::condition_variable condvar;
+        std::atomic<int> waiters{0};
+    };
+    constexpr auto EXPANSION_WAIT_STRIPES = 64;
+    std::array<ExpansionWaitStripe, EXPANSION_WAIT_STRIPES> expansion_waits;
+
+    ExpansionWaitStripe& expansion_wait_stripe(const UCTNode* const node) {
+        const auto address = reinterpret_cast<std::uintptr_t>(node);
+        return expansion_waits[(address / sizeof(UCTNode))
+                               % EXPANSION_WAIT_STRIPES];
+    }
+}
+
+UCTNode::ExpansionWaitStats UCTNode::m_expansion_wait_stats;
+
+void UCTNode::wait_expansion() const {
+    // Expansions which don't need the network finish within the spin,
+    // the others take at least a network evaluation. Sleep through
+    // those so the evaluating threads get the cores.
+    constexpr auto SPINS = 1000;
+    const auto start = std::chrono::steady_clock::now();
+    auto parked = false;
+    for (auto i = 0; i < SPINS; i++) {
+        if (m_expand_state.load() != ExpandState::EXPANDING) {
+            break;
+        }
+    }
+    if (m_expand_state.load() == ExpandState::EXPANDING) {
+        // The waiter count is raised before checking the state, and
+        // wake_expansion_waiters() checks it after changing the state,
+        // so one of them sees the other.
+        auto& stripe = expansion_wait_stripe(this);
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        stripe.waiters++;
+        stripe.condvar.wait(lock, [this] {
+            return m_expand_state.load() != ExpandState::EXPANDING;
+        });
+        stripe.waiters--;
+        parked = true;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+    m_expansion_wait_stats.waits++;
+    m_expansion_wait_stats.parked += parked ? 1 : 0;
+    m_expansion_wait_stats.wait_ns += elapsed.count();
+}
+
+void UCTNode::wake_expansion_waiters() const {
+    auto& stripe = expansion_wait_stripe(this);
+    if (stripe.waiters.load() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+        }
+        stripe.condvar.notify_all();
+    }
+}
+
+const UCTNode::ExpansionWaitStats& UCTNode::get_expansion_wait_stats() {
+    return m_expansion_wait_stats;
+}
+
+void UCTNode::reset_expansion_wait_stats() {
+    m_expansion_wait_stats.waits = 0;
+    m_expansion_wait_stats.parked = 0;
+    m_expansion_wait_stats.wait_ns = 0;
+}
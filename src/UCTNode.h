@@ -34,13 +34,22 @@
 
 #include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <istream>
+#include <map>
 #include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "GameState.h"
 #include "Network.h"
+#include "NodeArena.h"
 #include "SMP.h"
+#include "SearchState.h"
+#include "UCTNodeChildren.h"
 #include "UCTNodePointer.h"
 
 class UCTNode {
@@ -52,18 +61,76 @@ public:
     // Defined in UCTNode.cpp
     explicit UCTNode(int vertex, float policy);
     UCTNode() = delete;
-    ~UCTNode() = default;
+    ~UCTNode() {
+        assert(m_refs.load() <= 1);
+    }
 
+    // Nodes and their child arrays live in the tree arena.
+    static void* operator new(const std::size_t size) {
+        return NodeArena::allocate(size);
+    }
+    static void operator delete(void* const ptr, const std::size_t size) {
+        NodeArena::deallocate(ptr, size);
+    }
+
+    // generation is that of the search, a node expanded in an earlier
+    // generation may add the children it skipped.
     bool create_children(Network& network, std::atomic<int>& nodecount,
-                         const GameState& state, float& eval,
-                         float min_psa_ratio = 0.0f);
+                         const SearchState& state, float& eval,
+                         float min_psa_ratio = 0.0f,
+                         std::uint16_t generation = 0);
+    // create_children() split around the network evaluation, so that
+    // the evaluations of several leaves can be batched.  A successful
+    // begin_expansion() must be followed by finish_expansion() or
+    // cancel_expansion(). Expanding a node without children counts
+    // the visit of its evaluation.
+    bool begin_expansion(const SearchState& state, float min_psa_ratio = 0.0f,
+                         std::uint16_t generation = 0);
+    void finish_expansion(std::atomic<int>& nodecount, const SearchState& state,
+                          const Network::Netresult& raw_netlist, float& eval,
+                          float min_psa_ratio = 0.0f);
+    void cancel_expansion();
 
-    const std::vector<UCTNodePointer>& get_children() const;
+    const UCTNodeChildren& get_children() const;
     void sort_children(int color, float lcb_min_visits);
     UCTNode& get_best_root_child(int color) const;
-    UCTNode* uct_select_child(int color, bool is_root);
+    size_t get_best_root_child_index(int color) const;
+    // Statistics of the edges to the children. With transpositions they
+    // only count the visits made through this node, unlike those of the
+    // child nodes, so they are what a node compares its children by.
+    int get_max_child_visits() const;
+    float get_child_eval(size_t index, int tomove) const;
+    float get_child_eval_lcb(size_t index, int color) const;
+    // Returns the index of the selected child, and adds virtual loss
+    // to the edge leading to it. The child may not be inflated yet.
+    size_t uct_select_child(int color, bool is_root);
+    void child_virtual_loss_undo(size_t index);
+    void update_child(size_t index, float eval);
+    void invalidate_child(size_t index);
+    void set_child_active(size_t index, bool active);
 
-    size_t count_nodes_and_clear_expand_state();
+    // Number of child pointers below this node.
+    size_t count_nodes() const;
+    // Hand the children which only this node references to the caller,
+    // and drop the references to the others, so that deleting the node
+    // doesn't recurse. Returns the number of child pointers it had.
+    size_t detach_children(std::vector<UCTNode*>& detached);
+    // Memory held below this node, keyed by the epoch in which each part
+    // was last searched, see UCTNodeChildren::touch().
+    void cold_memory(std::map<std::uint32_t, size_t>& memory) const;
+    // Drop the children of the nodes below which were last searched
+    // before the given epoch. These nodes keep their statistics, and are
+    // expanded again if the search returns to them. Returns the number of
+    // child pointers dropped. Not thread-safe.
+    size_t collapse_cold(std::uint32_t epoch);
+    // Nodes are shared by several parents when transpositions
+    // are detected. The reference held by the transposition table
+    // doesn't make a node shared.
+    void add_ref();
+    bool release_ref();
+    void add_table_ref();
+    bool release_table_ref();
+    bool is_shared() const;
     bool first_visit() const;
     bool has_children() const;
     bool expandable(float min_psa_ratio = 0.0f) const;
@@ -86,15 +153,33 @@ public:
 
     // Defined in UCTNodeRoot.cpp, only to be called on m_root in UCTSearch
     void randomize_first_proportionally();
+    // Fast searches, see cfg_fast_visits, get no Dirichlet noise.
     void prepare_root_node(Network& network, int color,
-                           std::atomic<int>& nodecount, GameState& state);
+                           std::atomic<int>& nodecount, GameState& state,
+                           std::uint16_t generation, bool fast_search = false);
 
     UCTNode* get_first_child() const;
     UCTNode* get_nopass_child(FastState& state) const;
-    std::unique_ptr<UCTNode> find_child(int move);
+    UCTNodePointer::Root find_child(int move);
     void inflate_all_children();
 
-    void clear_expand_state();
+    // Threads which had to wait for another one to finish expanding a
+    // node, how many of them went to sleep, and the time they waited.
+    struct ExpansionWaitStats {
+        std::atomic<std::int64_t> waits{0};
+        std::atomic<std::int64_t> parked{0};
+        std::atomic<std::int64_t> wait_ns{0};
+    };
+    static const ExpansionWaitStats& get_expansion_wait_stats();
+    static void reset_expansion_wait_stats();
+
+    // Defined in UCTNodeIO.cpp, writes the subtree in preorder. Shared
+    // nodes are written once, and loaded back as shared nodes.
+    void save_subtree(std::ostream& out) const;
+    // Reads a subtree written by save_subtree() into a node which has not
+    // been expanded. Returns false if the data is truncated or invalid,
+    // or doesn't fit in the tree memory budget.
+    bool load_subtree(std::istream& in);
 
 private:
     enum Status : char {
@@ -102,6 +187,15 @@ private:
         PRUNED,
         ACTIVE
     };
+    size_t count_nodes(std::unordered_set<const UCTNode*>& shared_seen) const;
+    void save_subtree(
+        std::ostream& out,
+        std::unordered_map<const UCTNode*, std::uint32_t>& shared_ids) const;
+    bool load_subtree(std::istream& in, std::vector<UCTNode*>& shared);
+    void cold_memory(std::map<std::uint32_t, size_t>& memory,
+                     std::unordered_set<const UCTNode*>& shared_seen) const;
+    size_t collapse_cold(std::uint32_t epoch,
+                         std::unordered_set<const UCTNode*>& shared_seen);
     void link_nodelist(std::atomic<int>& nodecount,
                        std::vector<Network::PolicyVertexPair>& nodelist,
                        float min_psa_ratio);
@@ -127,6 +221,9 @@ private:
     // Initialized to small non-zero value to avoid accidental zero variances
     // at low visits.
     std::atomic<float> m_squared_eval_diff{1e-4f};
+    // Number of UCTNodePointers and roots referencing this node, plus
+    // TABLE_REF while the transposition table holds it.
+    std::atomic<std::uint32_t> m_refs{1};
     std::atomic<double> m_blackevals{0.0};
     std::atomic<Status> m_status{ACTIVE};
 
@@ -146,15 +243,19 @@ private:
         EXPANDED,
     };
     std::atomic<ExpandState> m_expand_state{ExpandState::INITIAL};
+    // Generation of the search which last expanded the node. An EXPANDED
+    // node from an earlier generation may be expanded again.
+    std::atomic<std::uint16_t> m_expand_generation{0};
 
     // Tree data
     std::atomic<float> m_min_psa_ratio_children{2.0f};
-    std::vector<UCTNodePointer> m_children;
+    UCTNodeChildren m_children;
 
     //  m_expand_state manipulation methods
-    // INITIAL -> EXPANDING
-    // Return false if current state is not INITIAL
-    bool acquire_expanding();
+    // INITIAL -> EXPANDING, or EXPANDED -> EXPANDING if the node was
+    // expanded in an earlier generation.
+    // Return false otherwise
+    bool acquire_expanding(std::uint16_t generation);
 
     // EXPANDING -> DONE
     void expand_done();
@@ -164,6 +265,11 @@ private:
 
     // wait until we are on EXPANDED state
     void wait_expanded() const;
+    // Spin, then sleep until the expansion is finished.
+    void wait_expansion() const;
+    void wake_expansion_waiters() const;
+
+    static ExpansionWaitStats m_expansion_wait_stats;
 };
 
 #endif
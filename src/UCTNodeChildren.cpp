@@ -0,0 +1,181 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "UCTNodeChildren.h"
+
+#include "NodeArena.h"
+#include "Utils.h"
+
+std::atomic<std::uint32_t> UCTNodeChildren::s_epoch{0};
+
+UCTNodeChildren::~UCTNodeChildren() {
+    clear();
+}
+
+void UCTNodeChildren::clear() {
+    if (!m_block) {
+        return;
+    }
+    for (auto i = size_t{0}; i < m_size; i++) {
+        nodes()[i].~UCTNodePointer();
+    }
+    NodeArena::deallocate(m_block, block_size(m_capacity));
+    UCTNodePointer::decrement_tree_size(m_capacity * STATS_SIZE);
+    m_block = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+    m_total_visits = 0;
+    m_visited_policy = 0.0f;
+}
+
+void UCTNodeChildren::reserve(const size_t capacity) {
+    if (capacity <= m_capacity) {
+        return;
+    }
+    auto order = std::vector<size_t>(m_size);
+    std::iota(std::begin(order), std::end(order), size_t{0});
+    rebuild(order, capacity);
+}
+
+void UCTNodeChildren::emplace_back(const std::int16_t vertex,
+                                   const float policy) {
+    if (m_size == m_capacity) {
+        reserve(std::max(size_t{4}, 2 * size_t{m_capacity}));
+    }
+    const auto i = m_size++;
+    new (&nodes()[i]) UCTNodePointer(vertex, policy);
+    new (&blackevals()[i]) std::atomic<double>(0.0);
+    new (&visits()[i]) std::atomic<int>(0);
+    policies()[i] = policy;
+    new (&virtual_losses()[i]) std::atomic<std::int16_t>(0);
+    new (&states()[i]) std::atomic<State>(ACTIVE);
+}
+
+void UCTNodeChildren::swap(const size_t a, const size_t b) {
+    auto order = std::vector<size_t>(m_size);
+    std::iota(std::begin(order), std::end(order), size_t{0});
+    std::swap(order[a], order[b]);
+    rebuild(order, m_capacity);
+}
+
+void UCTNodeChildren::virtual_loss(const size_t i, const int count) {
+    virtual_losses()[i] += count;
+}
+
+void UCTNodeChildren::virtual_loss_undo(const size_t i, const int count) {
+    virtual_losses()[i] -= count;
+}
+
+void UCTNodeChildren::update(const size_t i, const float eval) {
+    const auto old_visits = visits()[i]++;
+    Utils::atomic_add(blackevals()[i], double(eval));
+    if (get_state(i) != INVALID) {
+        m_total_visits++;
+        if (old_visits == 0) {
+            Utils::atomic_add(m_visited_policy, get_policy(i));
+        }
+    }
+}
+
+void UCTNodeChildren::account(const size_t i, const int sign) {
+    if (get_state(i) == INVALID) {
+        return;
+    }
+    const auto visits = get_visits(i);
+    m_total_visits += sign * visits;
+    if (visits > 0) {
+        Utils::atomic_add(m_visited_policy, sign * get_policy(i));
+    }
+}
+
+void UCTNodeChildren::set_policy(const size_t i, const float policy) {
+    account(i, -1);
+    policies()[i] = policy;
+    account(i, 1);
+}
+
+void UCTNodeChildren::set_state(const size_t i, const State state) {
+    // Children are only invalidated before their first visit, so this
+    // doesn't race with update().
+    account(i, -1);
+    states()[i] = state;
+    account(i, 1);
+}
+
+void UCTNodeChildren::set_stats(const size_t i, const int visit_count,
+                                const double blackeval_sum) {
+    account(i, -1);
+    visits()[i] = visit_count;
+    blackevals()[i] = blackeval_sum;
+    account(i, 1);
+}
+
+void UCTNodeChildren::rebuild(const std::vector<size_t>& order,
+                              const size_t capacity) {
+    assert(order.size() <= capacity);
+
+    UCTNodeChildren fresh;
+    fresh.m_block = static_cast<char*>(NodeArena::allocate(block_size(capacity)));
+    fresh.m_capacity = static_cast<std::uint16_t>(capacity);
+    UCTNodePointer::increment_tree_size(capacity * STATS_SIZE);
+
+    for (const auto i : order) {
+        const auto j = fresh.m_size++;
+        new (&fresh.nodes()[j]) UCTNodePointer(std::move(nodes()[i]));
+        new (&fresh.blackevals()[j]) std::atomic<double>(get_blackevals(i));
+        new (&fresh.visits()[j]) std::atomic<int>(get_visits(i));
+        fresh.policies()[j] = get_policy(i);
+        new (&fresh.virtual_losses()[j])
+            std::atomic<std::int16_t>(virtual_losses()[i].load());
+        new (&fresh.states()[j]) std::atomic<State>(get_state(i));
+    }
+
+    // The old block, with whatever was not moved out of it, is
+    // released by fresh.
+    std::swap(m_block, fresh.m_block);
+    std::swap(m_size, fresh.m_size);
+    std::swap(m_capacity, fresh.m_capacity);
+
+    // Children may have been removed, and summing again also drops
+    // the rounding errors.
+    m_total_visits = 0;
+    m_visited_policy = 0.0f;
+    for (auto i = size_t{0}; i < m_size; i++) {
+        account(i, 1);
+    }
+}
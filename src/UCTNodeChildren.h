@@ -0,0 +1,243 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef UCTNODECHILDREN_H_INCLUDED
+#define UCTNODECHILDREN_H_INCLUDED
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+#include "UCTNodePointer.h"
+
+// The children of a UCTNode, together with the statistics of the edges
+// leading to them. Everything uct_select_child() needs is kept in
+// contiguous arrays owned by the parent, so scoring the children of a node
+// does not touch the child nodes themselves:
+//
+//  [UCTNodePointer x cap][blackevals x cap][visits x cap][policy x cap]
+//  [virtual loss x cap][state x cap]
+//
+// The edge statistics are updated alongside those of the child node.
+// Like the std::vector this replaces, it can only be modified while the
+// parent is being expanded, or when no search is running.
+class UCTNodeChildren {
+public:
+    // Mirrors the status of the child node.
+    enum State : std::uint8_t { INVALID, PRUNED, ACTIVE };
+
+    UCTNodeChildren() = default;
+    ~UCTNodeChildren();
+    UCTNodeChildren(const UCTNodeChildren&) = delete;
+    UCTNodeChildren& operator=(const UCTNodeChildren&) = delete;
+
+    UCTNodePointer* begin() {
+        return nodes();
+    }
+    UCTNodePointer* end() {
+        return nodes() + m_size;
+    }
+    const UCTNodePointer* begin() const {
+        return nodes();
+    }
+    const UCTNodePointer* end() const {
+        return nodes() + m_size;
+    }
+    size_t size() const {
+        return m_size;
+    }
+    bool empty() const {
+        return m_size == 0;
+    }
+    UCTNodePointer& operator[](const size_t i) {
+        return nodes()[i];
+    }
+    const UCTNodePointer& operator[](const size_t i) const {
+        return nodes()[i];
+    }
+    const UCTNodePointer& front() const {
+        return nodes()[0];
+    }
+
+    void reserve(size_t capacity);
+    void emplace_back(std::int16_t vertex, float policy);
+    // Destroy all children. Not thread-safe.
+    void clear();
+    // Bytes held by the children and their statistics, not counting
+    // the child nodes themselves.
+    size_t memory_used() const {
+        return block_size(m_capacity);
+    }
+
+    // Reordering, these keep the edge statistics with their child.
+    // Not thread-safe.
+    template <typename Pred>
+    void remove_if(Pred pred);
+    // Same order as std::stable_sort over the reversed range,
+    // i.e. the greatest child comes first. comp is given the indices
+    // of two children, to compare their edge statistics.
+    template <typename Comp>
+    void sort_reverse(Comp comp);
+    void swap(size_t a, size_t b);
+
+    // Edge statistics.
+    int get_visits(const size_t i) const {
+        return visits()[i].load();
+    }
+    double get_blackevals(const size_t i) const {
+        return blackevals()[i].load();
+    }
+    float get_policy(const size_t i) const {
+        return policies()[i];
+    }
+    void set_policy(size_t i, float policy);
+    int get_virtual_loss(const size_t i) const {
+        return virtual_losses()[i].load();
+    }
+    State get_state(const size_t i) const {
+        return states()[i].load();
+    }
+    void set_state(size_t i, State state);
+    // For restoring a saved tree.
+    void set_stats(size_t i, int visit_count, double blackeval_sum);
+    void virtual_loss(size_t i, int count);
+    void virtual_loss_undo(size_t i, int count);
+    void update(size_t i, float eval);
+
+    // Totals over the children which are not INVALID, kept up to date by
+    // the methods above: their visits, and the policy of the visited
+    // ones.
+    int get_total_visits() const {
+        return m_total_visits.load();
+    }
+    float get_visited_policy() const {
+        // Additions and subtractions may leave a rounding error.
+        return std::max(0.0f, m_visited_policy.load());
+    }
+
+    // Searches are timed by an epoch which advances every so many
+    // playouts. A node's children record the last epoch in which one of
+    // them was selected, which finds the subtrees that are not searched
+    // any more.
+    static std::uint32_t get_epoch() {
+        return s_epoch.load(std::memory_order_relaxed);
+    }
+    static void advance_epoch() {
+        s_epoch++;
+    }
+    void touch() {
+        const auto epoch = get_epoch();
+        // Avoid writing to the shared cache line when nothing changes.
+        if (m_touched.load(std::memory_order_relaxed) != epoch) {
+            m_touched.store(epoch, std::memory_order_relaxed);
+        }
+    }
+    std::uint32_t last_touched() const {
+        return m_touched.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Bytes of edge statistics per child, next to the UCTNodePointer.
+    static constexpr size_t STATS_SIZE =
+        sizeof(std::atomic<double>) + sizeof(std::atomic<int>) + sizeof(float)
+        + sizeof(std::atomic<std::int16_t>) + sizeof(std::atomic<State>);
+
+    static size_t block_size(const size_t capacity) {
+        return capacity * (sizeof(UCTNodePointer) + STATS_SIZE);
+    }
+
+    UCTNodePointer* nodes() const {
+        return reinterpret_cast<UCTNodePointer*>(m_block);
+    }
+    std::atomic<double>* blackevals() const {
+        return reinterpret_cast<std::atomic<double>*>(
+            m_block + m_capacity * sizeof(UCTNodePointer));
+    }
+    std::atomic<int>* visits() const {
+        return reinterpret_cast<std::atomic<int>*>(blackevals() + m_capacity);
+    }
+    float* policies() const {
+        return reinterpret_cast<float*>(visits() + m_capacity);
+    }
+    std::atomic<std::int16_t>* virtual_losses() const {
+        return reinterpret_cast<std::atomic<std::int16_t>*>(policies()
+                                                           + m_capacity);
+    }
+    std::atomic<State>* states() const {
+        return reinterpret_cast<std::atomic<State>*>(virtual_losses()
+                                                     + m_capacity);
+    }
+
+    // Move the children listed in order into a new block of the given
+    // capacity, and destroy the ones that are not listed.
+    void rebuild(const std::vector<size_t>& order, size_t capacity);
+    // Add or remove the visits and policy of a child to the totals.
+    void account(size_t i, int sign);
+
+    static std::atomic<std::uint32_t> s_epoch;
+
+    char* m_block{nullptr};
+    std::uint16_t m_size{0};
+    std::uint16_t m_capacity{0};
+    std::atomic<std::uint32_t> m_touched{get_epoch()};
+    std::atomic<int> m_total_visits{0};
+    std::atomic<float> m_visited_policy{0.0f};
+};
+
+template <typename Pred>
+void UCTNodeChildren::remove_if(Pred pred) {
+    auto order = std::vector<size_t>{};
+    for (auto i = size_t{0}; i < m_size; i++) {
+        if (!pred(nodes()[i])) {
+            order.emplace_back(i);
+        }
+    }
+    if (order.size() != m_size) {
+        rebuild(order, m_capacity);
+    }
+}
+
+template <typename Comp>
+void UCTNodeChildren::sort_reverse(Comp comp) {
+    auto order = std::vector<size_t>(m_size);
+    std::iota(std::begin(order), std::end(order), size_t{0});
+    std::stable_sort(order.rbegin(), order.rend(),
+                     [this, &comp](const size_t a, const size_t b) {
+                         return comp(a, b);
+                     });
+    rebuild(order, m_capacity);
+}
+
+#endif
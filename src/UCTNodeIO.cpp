@@ -0,0 +1,227 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "UCTNode.h"
+#include "Utils.h"
+
+/*
+ * Saving and restoring search trees. Every node is written as
+ *
+ *  [flags u8][policy f32][visits i32][blackevals f64][net eval f32]
+ *  [squared eval diff f32][min psa ratio children f32][children u16]
+ *
+ * followed by one record per child edge
+ *
+ *  [move i16][policy f32][flags u8]([visits i32][blackevals f64])([id u32])
+ *
+ * where the edge statistics are only present for visited edges, and then
+ * by the records of the inflated children, in order.
+ *
+ * A node shared through a transposition is written once. The first edge
+ * to it gets the next id, and its record follows as usual. Later edges to
+ * it only hold that id, and have no record. Beyond the ids of the shared
+ * nodes, nothing needs to be held in memory but the path to the current
+ * node, so trees of any size can be streamed. Both directions recurse
+ * once per level, the stack goes as deep as the tree.
+ */
+
+using namespace Utils;
+
+namespace {
+    // Node flags.
+    constexpr auto NODE_EXPANDED = std::uint8_t{1};
+    constexpr auto NODE_STATUS_SHIFT = 1;
+    // Edge flags, the low bits hold the UCTNodeChildren::State.
+    constexpr auto EDGE_STATE_MASK = std::uint8_t{3};
+    constexpr auto EDGE_INFLATED = std::uint8_t{4};
+    constexpr auto EDGE_VISITED = std::uint8_t{8};
+    // The child is shared, and this edge gives it the next id.
+    constexpr auto EDGE_SHARED = std::uint8_t{16};
+    // The child is a shared node with an id, and is written elsewhere.
+    constexpr auto EDGE_LINK = std::uint8_t{32};
+}
+
+void UCTNode::save_subtree(std::ostream& out) const {
+    auto shared_ids = std::unordered_map<const UCTNode*, std::uint32_t>{};
+    save_subtree(out, shared_ids);
+}
+
+bool UCTNode::load_subtree(std::istream& in) {
+    auto shared = std::vector<UCTNode*>{};
+    return load_subtree(in, shared);
+}
+
+void UCTNode::save_subtree(
+    std::ostream& out,
+    std::unordered_map<const UCTNode*, std::uint32_t>& shared_ids) const {
+    const auto expanded = m_expand_state.load() == ExpandState::EXPANDED;
+    write_binary(out, std::uint8_t((expanded ? NODE_EXPANDED : 0)
+                                   | (m_status.load() << NODE_STATUS_SHIFT)));
+    write_binary(out, m_policy);
+    write_binary(out, m_visits.load());
+    write_binary(out, m_blackevals.load());
+    write_binary(out, m_net_eval);
+    write_binary(out, m_squared_eval_diff.load());
+    write_binary(out, m_min_psa_ratio_children.load());
+    write_binary(out, std::uint16_t(m_children.size()));
+
+    auto records = std::vector<const UCTNode*>{};
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        const auto& child = m_children[i];
+        const auto visits = m_children.get_visits(i);
+        auto flags = std::uint8_t(m_children.get_state(i));
+        flags |= visits > 0 ? EDGE_VISITED : 0;
+        auto id = shared_ids.end();
+        if (child.is_inflated()) {
+            if (!child->is_shared()) {
+                flags |= EDGE_INFLATED;
+                records.emplace_back(child.get());
+            } else {
+                const auto next_id = std::uint32_t(shared_ids.size());
+                const auto inserted =
+                    shared_ids.emplace(child.get(), next_id);
+                if (inserted.second) {
+                    flags |= EDGE_INFLATED | EDGE_SHARED;
+                    records.emplace_back(child.get());
+                } else {
+                    flags |= EDGE_LINK;
+                    id = inserted.first;
+                }
+            }
+        }
+        write_binary(out, std::int16_t(child.get_move()));
+        write_binary(out, m_children.get_policy(i));
+        write_binary(out, flags);
+        if (visits > 0) {
+            write_binary(out, visits);
+            write_binary(out, m_children.get_blackevals(i));
+        }
+        if (id != shared_ids.end()) {
+            write_binary(out, id->second);
+        }
+    }
+    for (const auto child : records) {
+        child->save_subtree(out, shared_ids);
+    }
+}
+
+bool UCTNode::load_subtree(std::istream& in, std::vector<UCTNode*>& shared) {
+    assert(m_expand_state == ExpandState::INITIAL && m_children.empty());
+
+    auto flags = std::uint8_t{};
+    auto visits = 0;
+    auto blackevals = 0.0;
+    auto squared_eval_diff = 0.0f;
+    auto min_psa_ratio = 0.0f;
+    auto num_children = std::uint16_t{};
+    if (!read_binary(in, flags) || !read_binary(in, m_policy)
+        || !read_binary(in, visits) || !read_binary(in, blackevals)
+        || !read_binary(in, m_net_eval)
+        || !read_binary(in, squared_eval_diff)
+        || !read_binary(in, min_psa_ratio)
+        || !read_binary(in, num_children)) {
+        return false;
+    }
+    const auto status = flags >> NODE_STATUS_SHIFT;
+    if (status > ACTIVE || visits < 0
+        || num_children > POTENTIAL_MOVES) {
+        return false;
+    }
+    m_visits = visits;
+    m_blackevals = blackevals;
+    m_squared_eval_diff = squared_eval_diff;
+    m_status = static_cast<Status>(status);
+    m_min_psa_ratio_children = min_psa_ratio;
+
+    m_children.reserve(num_children);
+    auto records = std::vector<UCTNode*>{};
+    for (auto i = size_t{0}; i < num_children; i++) {
+        auto move = std::int16_t{};
+        auto policy = 0.0f;
+        auto edge_flags = std::uint8_t{};
+        if (!read_binary(in, move) || !read_binary(in, policy)
+            || !read_binary(in, edge_flags)) {
+            return false;
+        }
+        const auto state = edge_flags & EDGE_STATE_MASK;
+        if (state > UCTNodeChildren::ACTIVE
+            || (move != FastBoard::PASS
+                && (move < 0 || move >= FastBoard::NUM_VERTICES))) {
+            return false;
+        }
+        m_children.emplace_back(move, policy);
+        m_children.set_state(i, static_cast<UCTNodeChildren::State>(state));
+        if (edge_flags & EDGE_VISITED) {
+            auto edge_visits = 0;
+            auto edge_blackevals = 0.0;
+            if (!read_binary(in, edge_visits)
+                || !read_binary(in, edge_blackevals) || edge_visits <= 0) {
+                return false;
+            }
+            m_children.set_stats(i, edge_visits, edge_blackevals);
+        }
+        if (edge_flags & EDGE_INFLATED) {
+            m_children[i].inflate();
+            records.emplace_back(m_children[i].get());
+            if (edge_flags & EDGE_SHARED) {
+                shared.emplace_back(m_children[i].get());
+            }
+        } else if (edge_flags & EDGE_LINK) {
+            auto id = std::uint32_t{};
+            if (!read_binary(in, id) || id >= shared.size()) {
+                return false;
+            }
+            shared[id]->add_ref();
+            m_children[i].link(shared[id]);
+        }
+    }
+    if (UCTNodePointer::get_tree_size() > cfg_max_tree_size) {
+        return false;
+    }
+    if (flags & NODE_EXPANDED) {
+        m_expand_state = ExpandState::EXPANDED;
+    }
+
+    for (const auto child : records) {
+        if (!child->load_subtree(in, shared)) {
+            return false;
+        }
+    }
+    return true;
+}
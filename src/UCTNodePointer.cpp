@@ -29,36 +29,77 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <memory>
 
 #include "UCTNode.h"
 
-std::atomic<size_t> UCTNodePointer::m_tree_size = {0};
+std::array<UCTNodePointer::TreeSizeShard, UCTNodePointer::TREE_SIZE_SHARDS>
+    UCTNodePointer::m_tree_size;
+
+UCTNodePointer::TreeSizeShard& UCTNodePointer::local_tree_size() {
+    // Threads take the shards in turn, they are only shared with more
+    // than TREE_SIZE_SHARDS threads.
+    static std::atomic<size_t> next_shard{0};
+    thread_local const auto shard = next_shard++ % TREE_SIZE_SHARDS;
+    return m_tree_size[shard];
+}
 
 size_t UCTNodePointer::get_tree_size() {
-    return m_tree_size.load();
+    auto total = std::int64_t{0};
+    for (const auto& shard : m_tree_size) {
+        total += shard.bytes.load(std::memory_order_relaxed);
+    }
+    // The shards are not read at the same instant.
+    return size_t(std::max(std::int64_t{0}, total));
 }
 
 void UCTNodePointer::increment_tree_size(const size_t sz) {
-    m_tree_size += sz;
+    local_tree_size().bytes.fetch_add(sz, std::memory_order_relaxed);
 }
 
 void UCTNodePointer::decrement_tree_size(const size_t sz) {
-    assert(UCTNodePointer::m_tree_size >= sz);
-    m_tree_size -= sz;
+    local_tree_size().bytes.fetch_sub(sz, std::memory_order_relaxed);
+}
+
+void UCTNodePointer::drop_reference(UCTNode* const node) {
+    if (node->release_ref()) {
+        decrement_tree_size(sizeof(UCTNode));
+        delete node;
+    }
+}
+
+void UCTNodePointer::drop_table_reference(UCTNode* const node) {
+    if (node->release_table_ref()) {
+        decrement_tree_size(sizeof(UCTNode));
+        delete node;
+    }
+}
+
+bool UCTNodePointer::release_root(UCTNode* const node) {
+    if (node->release_ref()) {
+        return true;
+    }
+    increment_tree_size(sizeof(UCTNode));
+    return false;
+}
+
+void UCTNodePointer::RootDeleter::operator()(UCTNode* const node) const {
+    if (release_root(node)) {
+        delete node;
+    }
 }
 
 UCTNodePointer::~UCTNodePointer() {
-    auto sz = sizeof(UCTNodePointer);
     auto v = m_data.load();
     if (is_inflated(v)) {
-        delete read_ptr(v);
-        sz += sizeof(UCTNode);
+        drop_reference(read_ptr(v));
     }
-    decrement_tree_size(sz);
+    decrement_tree_size(sizeof(UCTNodePointer));
 }
 
 UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
@@ -87,16 +128,31 @@ UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
     auto v = std::atomic_exchange(&m_data, nv);
 
     if (is_inflated(v)) {
-        decrement_tree_size(sizeof(UCTNode));
-        delete read_ptr(v);
+        drop_reference(read_ptr(v));
     }
     return *this;
 }
 
-UCTNode* UCTNodePointer::release() {
+UCTNodePointer::Root UCTNodePointer::make_root() const {
+    auto v = m_data.load();
+    assert(is_inflated(v));
+    auto node = read_ptr(v);
+    node->add_ref();
+    decrement_tree_size(sizeof(UCTNode));
+    return Root{node};
+}
+
+UCTNode* UCTNodePointer::release_reference() {
     auto v = std::atomic_exchange(&m_data, INVALID);
+    if (!is_inflated(v)) {
+        return nullptr;
+    }
+    auto node = read_ptr(v);
+    if (!node->release_ref()) {
+        return nullptr;
+    }
     decrement_tree_size(sizeof(UCTNode));
-    return read_ptr(v);
+    return node;
 }
 
 void UCTNodePointer::inflate() const {
@@ -120,6 +176,18 @@ void UCTNodePointer::inflate() const {
     }
 }
 
+bool UCTNodePointer::link(UCTNode* const node) const {
+    assert((reinterpret_cast<std::uint64_t>(node) & 3ULL) == 0);
+    const auto v2 = reinterpret_cast<std::uint64_t>(node) | POINTER;
+    auto v = m_data.load();
+    while (!is_inflated(v)) {
+        if (m_data.compare_exchange_strong(v, v2)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool UCTNodePointer::valid() const {
     auto v = m_data.load();
     if (is_inflated(v)) return read_ptr(v)->valid();
@@ -32,14 +32,18 @@
 
 #include "config.h"
 
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <memory>
 
 #include "SMP.h"
 
+class TranspositionTable;
 class UCTNode;
+class UCTNodeChildren;
 
 // 'lazy-initializable' version of std::unique_ptr<UCTNode>.
 // When a UCTNodePointer is constructed, the constructor arguments
@@ -55,11 +59,25 @@ class UCTNode;
 
 class UCTNodePointer {
 private:
+    // Account for the edge statistics stored next to the pointers,
+    // and for the transposition table.
+    friend class TranspositionTable;
+    friend class UCTNodeChildren;
+
     static constexpr std::uint64_t INVALID = 2;
     static constexpr std::uint64_t POINTER = 1;
     static constexpr std::uint64_t UNINFLATED = 0;
 
-    static std::atomic<size_t> m_tree_size;
+    // The tree size is counted on one shard per thread, each on its own
+    // cache line, so that threads growing the tree don't contend for a
+    // single counter. get_tree_size() sums them. A shard can go negative
+    // when its thread frees memory allocated by others.
+    static constexpr auto TREE_SIZE_SHARDS = 64;
+    struct alignas(64) TreeSizeShard {
+        std::atomic<std::int64_t> bytes{0};
+    };
+    static std::array<TreeSizeShard, TREE_SIZE_SHARDS> m_tree_size;
+    static TreeSizeShard& local_tree_size();
     static void increment_tree_size(size_t sz);
     static void decrement_tree_size(size_t sz);
 
@@ -97,6 +115,22 @@ private:
 
 public:
     static size_t get_tree_size();
+    // Drop one reference to a node in the tree, deleting it if it
+    // was the last one.
+    static void drop_reference(UCTNode* node);
+    // Same for the reference of the transposition table.
+    static void drop_table_reference(UCTNode* node);
+    // Drop the search's reference to its root. The root is left out of
+    // the tree size, it is counted again if it stays in another tree.
+    // Returns true if that was the last reference, for the caller to
+    // delete the node.
+    static bool release_root(UCTNode* node);
+
+    struct RootDeleter {
+        void operator()(UCTNode* node) const;
+    };
+    // Reference to the root node of a search.
+    using Root = std::unique_ptr<UCTNode, RootDeleter>;
 
     ~UCTNodePointer();
     UCTNodePointer(UCTNodePointer&& n);
@@ -118,10 +152,18 @@ public:
         return read_ptr(m_data.load());
     }
     UCTNodePointer& operator=(UCTNodePointer&& n);
-    UCTNode* release();
+    // Give up the reference to the node, if inflated. Returns the node
+    // if that was the last reference, for the caller to delete.
+    UCTNode* release_reference();
 
     // construct UCTNode instance from the vertex/policy pair
     void inflate() const;
+    // Point to an existing node instead, taking over a reference to it.
+    // Returns false if already inflated.
+    bool link(UCTNode* node) const;
+    // Take another reference to the node, as the root of the next search.
+    // The tree keeps its own, the node can be shared with other trees.
+    Root make_root() const;
 
     // proxy of UCTNode methods which can be called without
     // constructing UCTNode
@@ -42,6 +42,7 @@
 #include "GTP.h"
 #include "KoState.h"
 #include "Random.h"
+#include "SearchState.h"
 #include "UCTNode.h"
 #include "Utils.h"
 
@@ -88,10 +89,7 @@ void UCTNode::kill_superkos(const GameState& state) {
     }
 
     // Now do the actual deletion.
-    m_children.erase(
-        std::remove_if(begin(m_children), end(m_children),
-                       [](const auto& child) { return !child->valid(); }),
-        end(m_children));
+    m_children.remove_if([](const auto& child) { return !child->valid(); });
 }
 
 void UCTNode::dirichlet_noise(const float epsilon, const float alpha) {
@@ -119,9 +117,10 @@ void UCTNode::dirichlet_noise(const float epsilon, const float alpha) {
     child_cnt = 0;
     for (auto& child : m_children) {
         auto policy = child->get_policy();
-        auto eta_a = dirichlet_vector[child_cnt++];
+        auto eta_a = dirichlet_vector[child_cnt];
         policy = policy * (1 - epsilon) + epsilon * eta_a;
         child->set_policy(policy);
+        m_children.set_policy(child_cnt++, policy);
     }
 }
 
@@ -130,8 +129,8 @@ void UCTNode::randomize_first_proportionally() {
     auto norm_factor = 0.0;
     auto accum_vector = std::vector<double>{};
 
-    for (const auto& child : m_children) {
-        auto visits = child->get_visits();
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        auto visits = m_children.get_visits(i);
         if (norm_factor == 0.0) {
             norm_factor = visits;
             // Nonsensical options? End of game?
@@ -163,7 +162,7 @@ void UCTNode::randomize_first_proportionally() {
     assert(m_children.size() > index);
 
     // Now swap the child at index with the first child
-    std::iter_swap(begin(m_children), begin(m_children) + index);
+    m_children.swap(0, index);
 }
 
 UCTNode* UCTNode::get_nopass_child(FastState& state) const {
@@ -181,12 +180,12 @@ UCTNode* UCTNode::get_nopass_child(FastState& state) const {
 }
 
 // Used to find new root in UCTSearch.
-std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
+UCTNodePointer::Root UCTNode::find_child(const int move) {
     for (auto& child : m_children) {
         if (child.get_move() == move) {
             // no guarantee that this is a non-inflated node
             child.inflate();
-            return std::unique_ptr<UCTNode>(child.release());
+            return child.make_root();
         }
     }
 
@@ -202,11 +201,14 @@ void UCTNode::inflate_all_children() {
 
 void UCTNode::prepare_root_node(Network& network, const int color,
                                 std::atomic<int>& nodes,
-                                GameState& root_state) {
+                                GameState& root_state,
+                                const std::uint16_t generation,
+                                const bool fast_search) {
     float root_eval;
     const auto had_children = has_children();
     if (expandable()) {
-        create_children(network, nodes, root_state, root_eval);
+        create_children(network, nodes, SearchState{root_state}, root_eval,
+                        0.0f, generation);
     }
     if (had_children) {
         root_eval = get_net_eval(color);
@@ -223,7 +225,7 @@ void UCTNode::prepare_root_node(Network& network, const int color,
     // This also removes a lot of special cases.
     kill_superkos(root_state);
 
-    if (cfg_noise) {
+    if (cfg_noise && !fast_search) {
         // Adjust the Dirichlet noise's alpha constant to the board size
         auto alpha = 0.03f * 361.0f / NUM_INTERSECTIONS;
         dirichlet_noise(0.25f, alpha);
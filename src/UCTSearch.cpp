@@ -34,11 +34,19 @@
 #include <boost/scope_exit.hpp>
 #include <cassert>
 #include <cmath>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <fstream>
 #include <functional>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 #include "UCTSearch.h"
 
@@ -47,6 +55,7 @@
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "Random.h"
 #include "TimeControl.h"
 #include "Timing.h"
 #include "Training.h"
@@ -59,6 +68,17 @@ using namespace Utils;
 
 constexpr int UCTSearch::UNLIMITED_PLAYOUTS;
 
+namespace {
+    // Playouts per UCTNodeChildren epoch.
+    constexpr auto EPOCH_PLAYOUTS = 256;
+    // While pondering, cold subtrees are freed once the tree grows past
+    // COLLECT_AT of its memory budget, until it is down to COLLECT_TO.
+    constexpr auto COLLECT_AT = 0.9;
+    constexpr auto COLLECT_TO = 0.7;
+    // Nodes of old trees a worker deletes before each playout.
+    constexpr auto RECLAIM_SLICE = size_t{256};
+}
+
 class OutputAnalysisData {
 public:
     OutputAnalysisData(std::string move, const int visits, const float winrate,
@@ -89,6 +109,14 @@ public:
         return tmp;
     }
 
+    std::string get_json() const {
+        return str(boost::format("{\"move\":\"%s\",\"visits\":%d,"
+                                 "\"winrate\":%.4f,\"prior\":%.4f,"
+                                 "\"lcb\":%.4f,\"pv\":\"%s\"}")
+                   % m_move % m_visits % m_winrate % m_policy_prior
+                   % std::max(0.0f, m_lcb) % m_pv);
+    }
+
     friend bool operator<(const OutputAnalysisData& a,
                           const OutputAnalysisData& b) {
         if (a.m_lcb_ratio_exceeded && b.m_lcb_ratio_exceeded) {
@@ -113,11 +141,16 @@ private:
 };
 
 UCTSearch::UCTSearch(GameState& g, Network& network)
-    : m_rootstate(g), m_network(network) {
+    : m_rootstate(g), m_reclaim_group(thread_pool), m_network(network) {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
+    set_thread_limit(cfg_num_threads);
 
-    m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    m_root.reset(new UCTNode(FastBoard::PASS, 0.0f));
+}
+
+UCTSearch::~UCTSearch() {
+    m_reclaim_group.wait_all();
 }
 
 bool UCTSearch::advance_to_new_rootstate() {
@@ -147,30 +180,18 @@ bool UCTSearch::advance_to_new_rootstate() {
         return false;
     }
 
-    // Make sure that the nodes we destroyed the previous move are
-    // in fact destroyed.
-    while (!m_delete_futures.empty()) {
-        m_delete_futures.front().wait_all();
-        m_delete_futures.pop_front();
-    }
-
     // Try to replay moves advancing m_root
     for (auto i = 0; i < depth; i++) {
-        ThreadGroup tg(thread_pool);
-
         test->forward_move();
         const auto move = test->get_last_move();
 
         auto oldroot = std::move(m_root);
         m_root = oldroot->find_child(move);
 
-        // Lazy tree destruction.  Instead of calling the destructor of the
-        // old root node on the main thread, send the old root to a separate
-        // thread and destroy it from the child thread.  This will save a
-        // bit of time when dealing with large trees.
-        auto p = oldroot.release();
-        tg.add_task([p]() { delete p; });
-        m_delete_futures.push_back(std::move(tg));
+        // Lazy tree destruction. The search threads delete the rest of
+        // the old tree between their playouts, and subtract the nodes
+        // they free from m_nodes.
+        m_reclaimer.add(std::move(oldroot));
 
         if (!m_root) {
             // Tree hasn't been expanded this far
@@ -193,25 +214,47 @@ void UCTSearch::update_root() {
     // Definition of m_playouts is playouts per search call.
     // So reset this count now.
     m_playouts = 0;
+    m_leaf_batches = 0;
+    m_batched_leaves = 0;
+    UCTNode::reset_expansion_wait_stats();
+    m_reclaimer.reset_stats();
+#ifdef USE_OPENCL
+    batch_stats.single_evals = 0;
+    batch_stats.batch_evals = 0;
+    batch_stats.positions = 0;
+#endif
+
+    // Transpositions are only looked up among the nodes created in this
+    // search, the table must not keep discarded nodes alive. It takes a
+    // small part of the tree's memory budget.
+    m_transpositions.reset(cfg_transpositions ? cfg_max_tree_size / 64 : 0);
 
 #ifndef NDEBUG
-    auto start_nodes = m_root->count_nodes_and_clear_expand_state();
+    auto start_nodes = m_nodes.load();
 #endif
 
-    if (!advance_to_new_rootstate() || !m_root) {
-        m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    // Nodes expanded by an earlier search may add the children they
+    // skipped. The generation is stored in the 16 bits left in UCTNode,
+    // so the tree is not reused when it wraps around.
+    const auto wrapped = ++m_expand_generation == 0;
+    if (wrapped) {
+        m_expand_generation = 1;
+    }
+
+    // m_nodes includes the nodes of old trees until they are reclaimed.
+    if (wrapped || !advance_to_new_rootstate() || !m_root) {
+        m_reclaimer.add(std::move(m_root));
+        m_root.reset(new UCTNode(FastBoard::PASS, 0.0f));
     }
     // Clear last_rootstate to prevent accidental use.
     m_last_rootstate.reset(nullptr);
 
-    // Check how big our search tree (reused or new) is.
-    m_nodes = m_root->count_nodes_and_clear_expand_state();
-
 #ifndef NDEBUG
-    if (m_nodes > 0) {
+    const auto reused_nodes = int(m_root->count_nodes());
+    if (reused_nodes > 0) {
         myprintf("update_root, %d -> %d nodes (%.1f%% reused)\n",
-                 start_nodes, m_nodes.load(),
-                 100.0 * m_nodes.load() / start_nodes);
+                 start_nodes, reused_nodes,
+                 100.0 * reused_nodes / start_nodes);
     }
 #endif
 }
@@ -235,7 +278,7 @@ float UCTSearch::get_min_psa_ratio() const {
     return 0.0f;
 }
 
-SearchResult UCTSearch::play_simulation(GameState& currstate,
+SearchResult UCTSearch::play_simulation(SearchState& currstate,
                                         UCTNode* const node) {
     const auto color = currstate.get_to_move();
     auto result = SearchResult{};
@@ -258,8 +301,9 @@ SearchResult UCTSearch::play_simulation(GameState& currstate,
 
             // Careful: create_children() can throw a NetworkHaltException when
             // another thread requests draining the search.
-            const auto success = node->create_children(
-                m_network, m_nodes, currstate, eval, get_min_psa_ratio());
+            const auto success =
+                node->create_children(m_network, m_nodes, currstate, eval,
+                                      get_min_psa_ratio(), m_expand_generation);
             if (!had_children && success) {
                 result = SearchResult::from_eval(eval);
                 new_node = true;
@@ -268,14 +312,31 @@ SearchResult UCTSearch::play_simulation(GameState& currstate,
     }
 
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color, node == m_root.get());
-        auto move = next->get_move();
+        const auto index = node->uct_select_child(color, node == m_root.get());
+        BOOST_SCOPE_EXIT(node, index) {
+            node->child_virtual_loss_undo(index);
+        } BOOST_SCOPE_EXIT_END
+        const auto& child = node->get_children()[index];
+        auto move = child.get_move();
 
         currstate.play_move(move);
         if (move != FastBoard::PASS && currstate.superko()) {
-            next->invalidate();
+            node->invalidate_child(index);
         } else {
-            result = play_simulation(currstate, next);
+            m_transpositions.inflate(child, currstate.board.get_hash());
+            const auto next = child.get();
+            const auto edge_visits = node->get_children().get_visits(index);
+            if (m_transpositions.enabled() && edge_visits < next->get_visits()) {
+                // Searched further through another parent: back up what
+                // is known about it instead of evaluating it again.
+                result = SearchResult::from_eval(
+                    next->get_raw_eval(FastBoard::BLACK));
+            } else {
+                result = play_simulation(currstate, next);
+            }
+            if (result.valid()) {
+                node->update_child(index, result.eval());
+            }
         }
     }
 
@@ -287,6 +348,140 @@ SearchResult UCTSearch::play_simulation(GameState& currstate,
     return result;
 }
 
+int UCTSearch::play_simulations(std::vector<SearchLeaf>& leaves,
+                                UCTNode* const root) {
+    auto gathered = size_t{0};
+    auto pending = std::vector<SearchLeaf*>{};
+    try {
+        do {
+            auto& leaf = leaves[gathered++];
+            leaf.state.reset(m_rootstate);
+            descend(leaf, root);
+            if (leaf.pending) {
+                pending.emplace_back(&leaf);
+            }
+        } while (gathered < leaves.size());
+
+        if (!pending.empty()) {
+            auto states = std::vector<const SearchState*>{};
+            for (const auto leaf : pending) {
+                states.emplace_back(&leaf->state);
+            }
+            // Careful: this can throw a NetworkHaltException when
+            // another thread requests draining the search.
+            const auto netresults = m_network.get_output_batch(states);
+            m_leaf_batches++;
+            m_batched_leaves += pending.size();
+
+            for (auto i = size_t{0}; i < pending.size(); i++) {
+                auto& leaf = *pending[i];
+                float eval;
+                leaf.path.back().first->finish_expansion(
+                    m_nodes, leaf.state, netresults[i], eval,
+                    leaf.min_psa_ratio);
+                leaf.pending = false;
+                leaf.result = SearchResult::from_eval(eval);
+                leaf.new_node = true;
+            }
+        }
+    } catch (NetworkHaltException&) {
+        for (auto i = size_t{0}; i < gathered; i++) {
+            if (leaves[i].pending) {
+                leaves[i].path.back().first->cancel_expansion();
+            }
+            backup(leaves[i]);
+        }
+        throw;
+    }
+
+    auto playouts = 0;
+    for (auto i = size_t{0}; i < gathered; i++) {
+        backup(leaves[i]);
+        if (leaves[i].result.valid()) {
+            playouts++;
+        }
+    }
+    return playouts;
+}
+
+void UCTSearch::descend(SearchLeaf& leaf, UCTNode* node) {
+    auto& currstate = leaf.state;
+    leaf.path.clear();
+    leaf.result = SearchResult{};
+    leaf.pending = false;
+    leaf.new_node = false;
+
+    while (true) {
+        node->virtual_loss();
+        leaf.path.emplace_back(node, SearchLeaf::NO_CHILD);
+
+        if (node->expandable()) {
+            if (currstate.get_passes() >= 2) {
+                auto score = currstate.final_score();
+                leaf.result = SearchResult::from_score(score);
+                return;
+            }
+            if (!node->has_children()) {
+                // Keep the node locked until the batch is evaluated.
+                // Other descents reaching it stop here.
+                leaf.min_psa_ratio = get_min_psa_ratio();
+                leaf.pending = node->begin_expansion(
+                    currstate, leaf.min_psa_ratio, m_expand_generation);
+                return;
+            }
+            // Widening a node is not deferred: selecting through it
+            // would wait for the expansion to finish.
+            float eval;
+            node->create_children(m_network, m_nodes, currstate, eval,
+                                  get_min_psa_ratio(), m_expand_generation);
+        }
+        if (!node->has_children()) {
+            return;
+        }
+
+        const auto color = currstate.get_to_move();
+        const auto index = node->uct_select_child(color, node == m_root.get());
+        leaf.path.back().second = index;
+        const auto& child = node->get_children()[index];
+        const auto move = child.get_move();
+
+        currstate.play_move(move);
+        if (move != FastBoard::PASS && currstate.superko()) {
+            node->invalidate_child(index);
+            return;
+        }
+        m_transpositions.inflate(child, currstate.board.get_hash());
+        const auto next = child.get();
+        const auto edge_visits = node->get_children().get_visits(index);
+        if (m_transpositions.enabled() && edge_visits < next->get_visits()) {
+            leaf.result =
+                SearchResult::from_eval(next->get_raw_eval(FastBoard::BLACK));
+            return;
+        }
+        node = next;
+    }
+}
+
+void UCTSearch::backup(const SearchLeaf& leaf) {
+    const auto& result = leaf.result;
+    for (auto it = leaf.path.rbegin(); it != leaf.path.rend(); ++it) {
+        const auto node = it->first;
+        const auto index = it->second;
+        if (index != SearchLeaf::NO_CHILD) {
+            if (result.valid()) {
+                node->update_child(index, result.eval());
+            }
+            node->child_virtual_loss_undo(index);
+        }
+        // New node was updated in finish_expansion().
+        const auto new_node = leaf.new_node && it == leaf.path.rbegin();
+        if (result.valid() && !new_node) {
+            node->update(result.eval());
+        }
+        node->virtual_loss_undo();
+    }
+}
+
 void UCTSearch::dump_stats(const FastState& state, UCTNode& parent) {
     if (cfg_quiet || !parent.has_children()) {
         return;
@@ -294,69 +489,66 @@ void UCTSearch::dump_stats(const FastState& state, UCTNode& parent) {
 
     const int color = state.get_to_move();
 
-    auto max_visits = 0;
-    for (const auto& node : parent.get_children()) {
-        max_visits = std::max(max_visits, node->get_visits());
-    }
-
     // sort children, put best move on top
-    parent.sort_children(color, cfg_lcb_min_visit_ratio * max_visits);
+    const auto lcb_min_visits =
+        cfg_lcb_min_visit_ratio * parent.get_max_child_visits();
+    parent.sort_children(color, lcb_min_visits);
 
     if (parent.get_first_child()->first_visit()) {
         return;
     }
 
-    int movecount = 0;
-    for (const auto& node : parent.get_children()) {
+    const auto& children = parent.get_children();
+    for (auto i = size_t{0}; i < children.size(); i++) {
         // Always display at least two moves. In the case there is
         // only one move searched the user could get an idea why.
-        if (++movecount > 2 && !node->get_visits()) break;
+        const auto visits = children.get_visits(i);
+        if (i >= 2 && !visits) break;
 
-        auto move = state.move_to_text(node->get_move());
+        const auto& node = children[i];
+        auto move = state.move_to_text(node.get_move());
         auto tmpstate = FastState{state};
-        tmpstate.play_move(node->get_move());
+        tmpstate.play_move(node.get_move());
         auto pv = move + " " + get_pv(tmpstate, *node);
 
         myprintf("%4s -> %7d (V: %5.2f%%) (LCB: %5.2f%%) (N: %5.2f%%) PV: %s\n",
-                 move.c_str(), node->get_visits(),
-                 node->get_visits() ? node->get_raw_eval(color) * 100.0f : 0.0f,
-                 std::max(0.0f, node->get_eval_lcb(color) * 100.0f),
-                 node->get_policy() * 100.0f, pv.c_str());
+                 move.c_str(), visits,
+                 visits ? parent.get_child_eval(i, color) * 100.0f : 0.0f,
+                 std::max(0.0f, parent.get_child_eval_lcb(i, color) * 100.0f),
+                 children.get_policy(i) * 100.0f, pv.c_str());
     }
     tree_stats(parent);
 }
 
-void UCTSearch::output_analysis(const FastState& state, const UCTNode& parent) {
+std::vector<OutputAnalysisData> UCTSearch::get_analysis_data(
+    const FastState& state, const UCTNode& parent, const size_t move_count) {
     // We need to make a copy of the data before sorting
     auto sortable_data = std::vector<OutputAnalysisData>();
 
     if (!parent.has_children()) {
-        return;
+        return sortable_data;
     }
 
     const auto color = state.get_to_move();
+    const auto max_visits = parent.get_max_child_visits();
 
-    auto max_visits = 0;
-    for (const auto& node : parent.get_children()) {
-        max_visits = std::max(max_visits, node->get_visits());
-    }
-
-    for (const auto& node : parent.get_children()) {
+    const auto& children = parent.get_children();
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        const auto& node = children[i];
+        auto visits = children.get_visits(i);
         // Send only variations with visits, unless more moves were
         // requested explicitly.
-        if (!node->get_visits()
-            && sortable_data.size() >= cfg_analyze_tags.post_move_count()) {
+        if (!visits && sortable_data.size() >= move_count) {
             continue;
         }
-        auto move = state.move_to_text(node->get_move());
+        auto move = state.move_to_text(node.get_move());
         auto tmpstate = FastState{state};
-        tmpstate.play_move(node->get_move());
+        tmpstate.play_move(node.get_move());
         auto rest_of_pv = get_pv(tmpstate, *node);
         auto pv = move + (rest_of_pv.empty() ? "" : " " + rest_of_pv);
-        auto move_eval = node->get_visits() ? node->get_raw_eval(color) : 0.0f;
-        auto policy = node->get_policy();
-        auto lcb = node->get_eval_lcb(color);
-        auto visits = node->get_visits();
+        auto move_eval = visits ? parent.get_child_eval(i, color) : 0.0f;
+        auto policy = children.get_policy(i);
+        auto lcb = parent.get_child_eval_lcb(i, color);
         // Need at least 2 visits for valid LCB.
         auto lcb_ratio_exceeded =
             visits > 2 && visits > max_visits * cfg_lcb_min_visit_ratio;
@@ -366,6 +558,15 @@ void UCTSearch::output_analysis(const FastState& state, const UCTNode& parent) {
     }
     // Sort array to decide order
     std::stable_sort(rbegin(sortable_data), rend(sortable_data));
+    return sortable_data;
+}
+
+void UCTSearch::output_analysis(const FastState& state, const UCTNode& parent) {
+    if (!parent.has_children()) {
+        return;
+    }
+    const auto sortable_data =
+        get_analysis_data(state, parent, cfg_analyze_tags.post_move_count());
 
     auto i = 0;
     // Output analysis data in gtp stream
@@ -472,13 +673,9 @@ bool UCTSearch::should_resign(const passflag_t passflag, const float besteval) {
 int UCTSearch::get_best_move(const passflag_t passflag) {
     int color = m_rootstate.board.get_to_move();
 
-    auto max_visits = 0;
-    for (const auto& node : m_root->get_children()) {
-        max_visits = std::max(max_visits, node->get_visits());
-    }
-
     // Make sure best is first
-    m_root->sort_children(color, cfg_lcb_min_visit_ratio * max_visits);
+    m_root->sort_children(
+        color, cfg_lcb_min_visit_ratio * m_root->get_max_child_visits());
 
     // Check whether to randomize the best move proportional
     // to the playout counts, early game only.
@@ -491,8 +688,9 @@ int UCTSearch::get_best_move(const passflag_t passflag) {
     assert(first_child != nullptr);
 
     auto bestmove = first_child->get_move();
-    auto besteval =
-        first_child->first_visit() ? 0.5f : first_child->get_raw_eval(color);
+    auto besteval = m_root->get_children().get_visits(0)
+                        ? m_root->get_child_eval(0, color)
+                        : 0.5f;
 
     // do we want to fiddle with the best move because of the rule set?
     if (passflag & UCTSearch::NOPASS) {
@@ -641,8 +839,56 @@ std::string UCTSearch::get_analysis(const int playouts) {
                % playouts % winrate % pvstring.c_str());
 }
 
+std::string UCTSearch::get_analysis_json() {
+    const auto color = m_rootstate.get_to_move();
+    auto moves = std::string{};
+    for (const auto& data : get_analysis_data(m_rootstate, *m_root, 0)) {
+        moves += (moves.empty() ? "" : ",") + data.get_json();
+    }
+    const auto winrate =
+        m_root->get_visits() ? m_root->get_raw_eval(color) : 0.5f;
+    return str(boost::format("{\"visits\":%d,\"winrate\":%.4f,"
+                             "\"moves\":[%s]}")
+               % m_root->get_visits() % winrate % moves);
+}
+
 bool UCTSearch::is_running() const {
-    return m_run && UCTNodePointer::get_tree_size() < cfg_max_tree_size;
+    return m_run && !m_collecting
+           && UCTNodePointer::get_tree_size() < cfg_max_tree_size;
+}
+
+bool UCTSearch::should_collect() const {
+    return m_collect_tree
+           && UCTNodePointer::get_tree_size() > COLLECT_AT * cfg_max_tree_size;
+}
+
+void UCTSearch::collect_tree() {
+    const auto start = Time{};
+    const auto tree_size = UCTNodePointer::get_tree_size();
+
+    // The table keeps the nodes it has seen alive.
+    m_transpositions.reset(cfg_transpositions ? cfg_max_tree_size / 64 : 0);
+
+    // Free the subtrees searched longest ago, but none which were
+    // searched in the current epoch.
+    auto memory = std::map<std::uint32_t, size_t>{};
+    m_root->cold_memory(memory);
+    const auto target = tree_size - COLLECT_TO * cfg_max_tree_size;
+    auto cutoff = std::uint32_t{0};
+    auto freeing = size_t{0};
+    for (const auto& epoch : memory) {
+        if (freeing >= target || epoch.first >= UCTNodeChildren::get_epoch()) {
+            break;
+        }
+        freeing += epoch.second;
+        cutoff = epoch.first + 1;
+    }
+    m_nodes -= int(m_root->collapse_cold(cutoff));
+
+    const auto freed = tree_size - UCTNodePointer::get_tree_size();
+    myprintf("Freed %d MiB of the search tree in %.1f ms.\n",
+             int(freed / (1024 * 1024)),
+             1000.0 * Time::timediff_seconds(start, Time{}));
 }
 
 int UCTSearch::est_playouts_left(const int elapsed_centis,
@@ -683,7 +929,9 @@ size_t UCTSearch::prune_noncontenders(const int color, const int elapsed_centis,
     const auto min_required_visits =
         Nfirst - est_playouts_left(elapsed_centis, time_for_move);
     auto pruned_nodes = size_t{0};
-    for (const auto& node : m_root->get_children()) {
+    const auto& children = m_root->get_children();
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        const auto& node = children[i];
         if (node->valid()) {
             const auto visits = node->get_visits();
             const auto has_enough_visits = visits >= min_required_visits;
@@ -694,7 +942,7 @@ size_t UCTSearch::prune_noncontenders(const int color, const int elapsed_centis,
             const auto prune_this_node = !(has_enough_visits || high_winrate);
 
             if (prune) {
-                node->set_active(!prune_this_node);
+                m_root->set_child_active(i, !prune_this_node);
             }
             if (prune_this_node) {
                 ++pruned_nodes;
@@ -748,11 +996,122 @@ bool UCTSearch::stop_thinking(const int elapsed_centis,
            || elapsed_centis >= time_for_move;
 }
 
+void UCTSearch::wake_controller() {
+    {
+        std::lock_guard<std::mutex> lock(m_controller_mutex);
+        m_controller_wake = true;
+    }
+    m_controller_cv.notify_one();
+}
+
+void UCTSearch::wait_for_event(const int centis) {
+    std::unique_lock<std::mutex> lock(m_controller_mutex);
+    const auto woken = [this]() { return m_controller_wake; };
+    if (centis < 0) {
+        m_controller_cv.wait(lock, woken);
+    } else {
+        m_controller_cv.wait_for(lock, std::chrono::milliseconds(10 * centis),
+                                 woken);
+    }
+    m_controller_wake = false;
+}
+
+void UCTSearch::watch_input() {
+    // Checking m_run every 50 ms only delays the end of this thread, GTP
+    // input wakes the controller as soon as it arrives.
+    while (m_run) {
+        if (Utils::wait_for_input(50)) {
+            wake_controller();
+            return;
+        }
+    }
+}
+
+void UCTSearch::schedule_check(const int elapsed_centis,
+                               const int time_for_move) {
+    // Wake up exactly at the playout or visit limit, and sooner if time
+    // management could stop early: look again after a fraction of the
+    // playouts it thinks are left.
+    constexpr auto EARLY_STOP_CHECKS = 16;
+    const auto playouts = m_playouts.load();
+    auto next_check = std::max(1, std::min(m_maxplayouts - playouts,
+                                           m_maxvisits - m_root->get_visits()));
+    if (cfg_timemanage != TimeManagement::OFF) {
+        next_check = std::min(
+            next_check,
+            std::max(1, est_playouts_left(elapsed_centis, time_for_move)
+                            / EARLY_STOP_CHECKS));
+    }
+    m_check_playouts = playouts + next_check;
+}
+
+void UCTSearch::reclaim_nodes() {
+    if (!m_reclaimer.empty()) {
+        m_nodes -= int(m_reclaimer.reclaim(RECLAIM_SLICE));
+    }
+}
+
+void UCTSearch::search_position(const int visits) {
+    update_root();
+    m_root->prepare_root_node(m_network, m_rootstate.get_to_move(), m_nodes,
+                              m_rootstate, m_expand_generation);
+
+    m_run = true;
+    auto currstate = SearchState{m_rootstate};
+    while (m_root->get_visits() < visits && is_running()) {
+        reclaim_nodes();
+        currstate.reset(m_rootstate);
+        const auto result = play_simulation(currstate, m_root.get());
+        if (result.valid()) {
+            increment_playouts();
+        }
+    }
+    m_run = false;
+}
+
+void UCTSearch::reclaim_in_background() {
+    if (m_reclaimer.empty()) {
+        return;
+    }
+    // Stops as soon as the next search starts, so it delays it by one
+    // slice at most.
+    m_reclaim_group.add_task([this]() {
+        while (!m_run && !m_reclaimer.empty()) {
+            reclaim_nodes();
+        }
+    });
+}
+
+void UCTSearch::stop_workers(ThreadGroup& tg) {
+    if (m_network_shared) {
+        tg.wait_all();
+        return;
+    }
+    m_network.drain_evals();
+    tg.wait_all();
+    m_network.resume_evals();
+}
+
 void UCTWorker::operator()() {
     try {
+        if (cfg_leaves > 1) {
+            auto leaves = std::vector<SearchLeaf>{};
+            leaves.reserve(cfg_leaves);
+            for (auto i = 0u; i < cfg_leaves; i++) {
+                leaves.emplace_back(m_rootstate);
+            }
+            do {
+                m_search->reclaim_nodes();
+                m_search->increment_playouts(
+                    m_search->play_simulations(leaves, m_root));
+            } while (m_search->is_running());
+            return;
+        }
+        auto currstate = SearchState{m_rootstate};
         do {
-            auto currstate = std::make_unique<GameState>(m_rootstate);
-            auto result = m_search->play_simulation(*currstate, m_root);
+            m_search->reclaim_nodes();
+            currstate.reset(m_rootstate);
+            auto result = m_search->play_simulation(currstate, m_root);
             if (result.valid()) {
                 m_search->increment_playouts();
             }
@@ -760,10 +1119,22 @@ void UCTWorker::operator()() {
     } catch (NetworkHaltException&) {
         // intentionally empty
     }
+    // Stopped by a full tree, or by the controller itself.
+    m_search->wake_controller();
 }
 
-void UCTSearch::increment_playouts() {
-    m_playouts++;
+void UCTSearch::increment_playouts(const int playouts) {
+    const auto total = (m_playouts += playouts);
+    const auto check = m_check_playouts.load();
+    if (total >= check && total - playouts < check) {
+        wake_controller();
+    }
+    if (total / EPOCH_PLAYOUTS != (total - playouts) / EPOCH_PLAYOUTS) {
+        UCTNodeChildren::advance_epoch();
+        if (should_collect()) {
+            wake_controller();
+        }
+    }
 }
 
 int UCTSearch::think(const int color, const passflag_t passflag) {
@@ -782,12 +1153,25 @@ int UCTSearch::think(const int color, const passflag_t passflag) {
 
     myprintf("Thinking at most %.1f seconds...\n", time_for_move / 100.0f);
 
+    // Playout cap randomization: most moves only get a fast search,
+    // which is left out of the policy training data.
+    auto full_search = true;
+    const auto max_visits = m_maxvisits;
+    if (cfg_fast_visits > 0) {
+        auto dist = std::uniform_real_distribution<float>{0.0f, 1.0f};
+        full_search = dist(Random::get_Rng()) < cfg_full_search_prob;
+        if (!full_search) {
+            m_maxvisits = std::min(m_maxvisits, cfg_fast_visits);
+        }
+    }
+
     // create a sorted list of legal moves (make sure we
     // play something legal and decent even in time trouble)
-    m_root->prepare_root_node(m_network, color, m_nodes, m_rootstate);
+    m_root->prepare_root_node(m_network, color, m_nodes, m_rootstate,
+                              m_expand_generation, !full_search);
 
     m_run = true;
-    int cpus = cfg_num_threads;
+    int cpus = m_threads;
     ThreadGroup tg(thread_pool);
     for (int i = 0; i < cpus; i++) {
         tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
@@ -796,11 +1180,24 @@ int UCTSearch::think(const int color, const passflag_t passflag) {
     auto keeprunning = true;
     auto last_update = 0;
     auto last_output = 0;
+    auto elapsed_centis = 0;
+    auto stop_requested = Time{};
     do {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        // Sleep until the next output or the time limit, unless a worker
+        // reaches the next playout check first.
+        schedule_check(elapsed_centis, time_for_move);
+        auto next_event = time_for_move;
+        if (cfg_analyze_tags.interval_centis()) {
+            next_event = std::min(
+                next_event, last_output + cfg_analyze_tags.interval_centis() + 1);
+        }
+        if (!cfg_quiet) {
+            next_event = std::min(next_event, last_update + 251);
+        }
+        wait_for_event(std::max(0, next_event - elapsed_centis));
 
-        Time elapsed;
-        int elapsed_centis = Time::timediff_centis(start, elapsed);
+        stop_requested = Time{};
+        elapsed_centis = Time::timediff_centis(start, stop_requested);
 
         if (cfg_analyze_tags.interval_centis()
             && elapsed_centis - last_output
@@ -827,13 +1224,14 @@ int UCTSearch::think(const int color, const passflag_t passflag) {
 
     // Stop the search.
     m_run = false;
-    m_network.drain_evals();
-    tg.wait_all();
-    m_network.resume_evals();
+    stop_workers(tg);
+    const auto stop_latency = Time::timediff_seconds(stop_requested, Time{});
+    m_maxvisits = max_visits;
+    reclaim_in_background();
 
     // Reactivate all pruned root children.
-    for (const auto& node : m_root->get_children()) {
-        node->set_active(true);
+    for (auto i = size_t{0}; i < m_root->get_children().size(); i++) {
+        m_root->set_child_active(i, true);
     }
 
     m_rootstate.stop_clock(color);
@@ -844,19 +1242,43 @@ int UCTSearch::think(const int color, const passflag_t passflag) {
     // Display search info.
     myprintf("\n");
     dump_stats(m_rootstate, *m_root);
-    Training::record(m_network, m_rootstate, *m_root);
+    Training::record(m_rootstate, *m_root, full_search);
 
-    Time elapsed;
-    int elapsed_centis = Time::timediff_centis(start, elapsed);
+    elapsed_centis = Time::timediff_centis(start, Time{});
     myprintf("%d visits, %d nodes, %d playouts, %.0f n/s\n\n",
              m_root->get_visits(), m_nodes.load(), m_playouts.load(),
              (m_playouts * 100.0) / (elapsed_centis + 1));
+    myprintf("Search stopped in %.1f ms.\n\n", 1000.0 * stop_latency);
+    if (m_transpositions.enabled()) {
+        myprintf("%d transpositions shared.\n\n",
+                 int(m_transpositions.get_links()));
+    }
+
+    if (m_leaf_batches > 0) {
+        myprintf("%.1f leaves gathered per network batch.\n\n",
+                 double(m_batched_leaves) / m_leaf_batches);
+    }
+
+    const auto& waits = UCTNode::get_expansion_wait_stats();
+    if (waits.waits > 0) {
+        myprintf("%d waits for node expansion, %d parked, %.1f ms in total.\n\n",
+                 int(waits.waits), int(waits.parked), waits.wait_ns / 1e6);
+    }
+
+    const auto& reclaimed = m_reclaimer.get_stats();
+    if (reclaimed.nodes > 0) {
+        myprintf("%d nodes of old trees freed in %.1f ms.\n\n",
+                 int(reclaimed.nodes), reclaimed.reclaim_ns / 1e6);
+    }
 
 #ifdef USE_OPENCL
-#ifndef NDEBUG
-    myprintf("batch stats: %d %d\n",
-             batch_stats.single_evals.load(), batch_stats.batch_evals.load());
-#endif
+    const auto batches =
+        batch_stats.single_evals.load() + batch_stats.batch_evals.load();
+    if (!cfg_cpu_only && batches > 0) {
+        myprintf("batch fill: %.1f%% (%d single evals, %d batches)\n\n",
+                 100.0 * batch_stats.positions / (batches * cfg_batch_size),
+                 int(batch_stats.single_evals), int(batch_stats.batch_evals));
+    }
 #endif
 
     int bestmove = get_best_move(passflag);
@@ -888,27 +1310,48 @@ void UCTSearch::ponder() {
     update_root();
 
     m_root->prepare_root_node(m_network, m_rootstate.board.get_to_move(),
-                              m_nodes, m_rootstate);
+                              m_nodes, m_rootstate, m_expand_generation);
 
     m_run = true;
+    m_collect_tree = true;
     ThreadGroup tg(thread_pool);
-    for (auto i = size_t{0}; i < cfg_num_threads; i++) {
+    for (auto i = 0; i < m_threads; i++) {
         tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
     }
+    auto input_watcher = std::thread(&UCTSearch::watch_input, this);
     Time start;
     auto keeprunning = true;
     auto last_output = 0;
+    auto elapsed_centis = 0;
+    auto stop_requested = Time{};
     do {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        schedule_check(0, 1);
         if (cfg_analyze_tags.interval_centis()) {
-            Time elapsed;
-            int elapsed_centis = Time::timediff_centis(start, elapsed);
-            if (elapsed_centis - last_output
-                > cfg_analyze_tags.interval_centis()) {
-                last_output = elapsed_centis;
-                output_analysis(m_rootstate, *m_root);
+            wait_for_event(std::max(0, last_output
+                                           + cfg_analyze_tags.interval_centis()
+                                           + 1 - elapsed_centis));
+        } else {
+            wait_for_event();
+        }
+        if (should_collect() && !Utils::input_pending()) {
+            // Keep analyzing within the memory budget: stop the
+            // workers, free cold subtrees and start them again.
+            m_collecting = true;
+            stop_workers(tg);
+            collect_tree();
+            m_collecting = false;
+            for (auto i = 0; i < m_threads; i++) {
+                tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
             }
         }
+        stop_requested = Time{};
+        elapsed_centis = Time::timediff_centis(start, stop_requested);
+        if (cfg_analyze_tags.interval_centis()
+            && elapsed_centis - last_output
+                   > cfg_analyze_tags.interval_centis()) {
+            last_output = elapsed_centis;
+            output_analysis(m_rootstate, *m_root);
+        }
         keeprunning = is_running();
         keeprunning &= !stop_thinking(0, 1);
     } while (!Utils::input_pending() && keeprunning);
@@ -920,15 +1363,18 @@ void UCTSearch::ponder() {
 
     // Stop the search.
     m_run = false;
-    m_network.drain_evals();
-    tg.wait_all();
-    m_network.resume_evals();
+    m_collect_tree = false;
+    stop_workers(tg);
+    const auto stop_latency = Time::timediff_seconds(stop_requested, Time{});
+    reclaim_in_background();
+    input_watcher.join();
 
     // Display search info.
     myprintf("\n");
     dump_stats(m_rootstate, *m_root);
 
     myprintf("\n%d visits, %d nodes\n\n", m_root->get_visits(), m_nodes.load());
+    myprintf("Search stopped in %.1f ms.\n\n", 1000.0 * stop_latency);
 
     // Copy the root state. Use to check for tree re-use in future calls.
     if (!disable_reuse) {
@@ -936,6 +1382,223 @@ void UCTSearch::ponder() {
     }
 }
 
+void UCTSearch::prefetch() {
+    // Predicted replies of the opponent are the likely roots of our next
+    // search, and their most likely answers the first nodes it expands.
+    // Evaluate them in order of probability, so that the NN cache has
+    // them when the real move arrives.
+    struct Item {
+        float prior;
+        int depth;
+        std::shared_ptr<const GameState> parent;
+        int move;
+        bool operator<(const Item& other) const {
+            return prior < other.prior;
+        }
+    };
+
+    auto queue = std::vector<Item>{};
+    queue.push_back({1.0f, 0, std::make_shared<GameState>(m_rootstate),
+                     FastBoard::NO_VERTEX});
+    auto busy = 0;
+    std::atomic<int> prefetched{0};
+    // Guards the queue and busy, and m_run changes while prefetching.
+    std::mutex mutex;
+    std::condition_variable queue_cv;
+
+    auto worker = [&]() {
+        try {
+            while (m_run) {
+                Item item;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    // Sleep while the others are still expanding the queue.
+                    queue_cv.wait(lock, [&]() {
+                        return !queue.empty() || busy == 0 || !m_run;
+                    });
+                    if (!m_run) {
+                        break;
+                    }
+                    if (queue.empty()) {
+                        // Everything has been evaluated.
+                        m_run = false;
+                        wake_controller();
+                        queue_cv.notify_all();
+                        break;
+                    }
+                    std::pop_heap(begin(queue), end(queue));
+                    item = std::move(queue.back());
+                    queue.pop_back();
+                    busy++;
+                }
+
+                auto state = std::make_shared<GameState>(*item.parent);
+                if (item.move != FastBoard::NO_VERTEX) {
+                    state->play_move(item.move);
+                }
+                // Same evaluation as UCTNode::create_children.
+                const auto raw_netlist = m_network.get_output(
+                    state.get(), Network::Ensemble::RANDOM_SYMMETRY);
+                prefetched++;
+
+                auto children = std::vector<Item>{};
+                if (item.depth < 2 && state->get_passes() < 2) {
+                    const auto to_move = state->get_to_move();
+                    for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+                        const auto x = i % BOARD_SIZE;
+                        const auto y = i / BOARD_SIZE;
+                        const auto vertex = state->board.get_vertex(x, y);
+                        if (state->is_move_legal(to_move, vertex)) {
+                            children.push_back({item.prior
+                                                    * raw_netlist.policy[i],
+                                                item.depth + 1, state, vertex});
+                        }
+                    }
+                    children.push_back({item.prior * raw_netlist.policy_pass,
+                                        item.depth + 1, state,
+                                        FastBoard::PASS});
+                    const auto count = std::min(
+                        children.size(), size_t(cfg_prefetch_replies));
+                    std::partial_sort(begin(children), begin(children) + count,
+                                      end(children),
+                                      [](const auto& a, const auto& b) {
+                                          return b < a;
+                                      });
+                    children.resize(count);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (auto& child : children) {
+                        queue.push_back(std::move(child));
+                        std::push_heap(begin(queue), end(queue));
+                    }
+                    busy--;
+                }
+                queue_cv.notify_all();
+            }
+        } catch (NetworkHaltException&) {
+            // intentionally empty
+        }
+    };
+
+    m_run = true;
+    ThreadGroup tg(thread_pool);
+    for (auto i = size_t{0}; i < cfg_num_threads; i++) {
+        tg.add_task(worker);
+    }
+    auto input_watcher = std::thread(&UCTSearch::watch_input, this);
+    do {
+        wait_for_event();
+    } while (!Utils::input_pending() && m_run);
+
+    // Real work has arrived, don't let it wait on us.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        m_run = false;
+    }
+    queue_cv.notify_all();
+    stop_workers(tg);
+    input_watcher.join();
+
+    myprintf("Prefetched %d positions.\n", prefetched.load());
+}
+
+namespace {
+    // Also rejects files written with the other byte order.
+    constexpr auto TREE_FILE_MAGIC = std::uint32_t{0x45525A4C}; // "LZRE"
+    // Version 2 writes shared nodes once, version 1 files are read as
+    // they are.
+    constexpr auto TREE_FILE_VERSION = std::uint32_t{2};
+}
+
+bool UCTSearch::save_tree(const std::string& filename) {
+    // Bring the tree to the current position, and keep it for the next
+    // search.
+    update_root();
+    m_last_rootstate = std::make_unique<GameState>(m_rootstate);
+
+    auto out = std::ofstream{filename, std::ios::binary};
+    if (!out) {
+        return false;
+    }
+    auto buffer = std::vector<char>(1 << 20);
+    out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+
+    const auto start = Time{};
+    Utils::write_binary(out, TREE_FILE_MAGIC);
+    Utils::write_binary(out, TREE_FILE_VERSION);
+    Utils::write_binary(out, std::uint32_t(BOARD_SIZE));
+    Utils::write_binary(out, m_rootstate.board.get_hash());
+    Utils::write_binary(out, m_rootstate.get_komi());
+    Utils::write_binary(out, m_network.get_network_hash());
+    m_root->save_subtree(out);
+    out.close();
+    if (!out) {
+        return false;
+    }
+    myprintf("Saved %d visits, %d nodes in %.1f ms.\n",
+             m_root->get_visits(), m_nodes.load(),
+             1000.0 * Time::timediff_seconds(start, Time{}));
+    return true;
+}
+
+bool UCTSearch::load_tree(const std::string& filename) {
+    auto in = std::ifstream{filename, std::ios::binary};
+    if (!in) {
+        return false;
+    }
+    auto buffer = std::vector<char>(1 << 20);
+    in.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+
+    const auto start = Time{};
+    auto magic = std::uint32_t{};
+    auto version = std::uint32_t{};
+    auto board_size = std::uint32_t{};
+    auto hash = std::uint64_t{};
+    auto komi = 0.0f;
+    auto network_hash = std::uint64_t{};
+    if (!Utils::read_binary(in, magic) || !Utils::read_binary(in, version)
+        || !Utils::read_binary(in, board_size)
+        || !Utils::read_binary(in, hash) || !Utils::read_binary(in, komi)
+        || !Utils::read_binary(in, network_hash)
+        || magic != TREE_FILE_MAGIC || version < 1
+        || version > TREE_FILE_VERSION) {
+        myprintf("Not a search tree file.\n");
+        return false;
+    }
+    if (board_size != BOARD_SIZE || hash != m_rootstate.board.get_hash()
+        || komi != m_rootstate.get_komi()) {
+        myprintf("The search tree is for another position.\n");
+        return false;
+    }
+    if (network_hash != m_network.get_network_hash()) {
+        myprintf("The search tree was made with other weights.\n");
+        return false;
+    }
+
+    // Release the current tree first, to make room for the new one.
+    m_transpositions.reset(0);
+    m_reclaim_group.wait_all();
+    m_reclaimer.add(std::move(m_root));
+    m_reclaimer.reclaim_all();
+    m_last_rootstate.reset();
+    m_root.reset(new UCTNode(FastBoard::PASS, 0.0f));
+    if (!m_root->load_subtree(in)) {
+        myprintf("Search tree file is damaged or too large.\n");
+        m_root.reset(new UCTNode(FastBoard::PASS, 0.0f));
+        return false;
+    }
+    m_nodes = int(m_root->count_nodes());
+    // The next search continues from this tree.
+    m_last_rootstate = std::make_unique<GameState>(m_rootstate);
+
+    myprintf("Loaded %d visits, %d nodes in %.1f ms.\n",
+             m_root->get_visits(), m_nodes.load(),
+             1000.0 * Time::timediff_seconds(start, Time{}));
+    return true;
+}
+
 void UCTSearch::set_playout_limit(const int playouts) {
     static_assert(
         std::is_convertible<decltype(playouts), decltype(m_maxplayouts)>::value,
@@ -943,6 +1606,14 @@ void UCTSearch::set_playout_limit(const int playouts) {
     m_maxplayouts = std::min(playouts, UNLIMITED_PLAYOUTS);
 }
 
+void UCTSearch::set_thread_limit(const int threads) {
+    m_threads = std::max(1, threads);
+}
+
+void UCTSearch::set_network_shared(const bool shared) {
+    m_network_shared = shared;
+}
+
 void UCTSearch::set_visit_limit(const int visits) {
     static_assert(
         std::is_convertible<decltype(visits), decltype(m_maxvisits)>::value,
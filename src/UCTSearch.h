@@ -31,19 +31,29 @@
 #define UCTSEARCH_H_INCLUDED
 
 #include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <future>
-#include <list>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include "FastBoard.h"
 #include "FastState.h"
 #include "GameState.h"
 #include "Network.h"
+#include "SearchState.h"
 #include "ThreadPool.h"
+#include "TranspositionTable.h"
+#include "TreeReclaimer.h"
 #include "UCTNode.h"
 
+class OutputAnalysisData;
+
 class SearchResult {
 public:
     SearchResult() = default;
@@ -72,6 +82,24 @@ private:
     float m_eval{0.0f};
 };
 
+// One descent of a multi-leaf playout, see UCTSearch::play_simulations().
+struct SearchLeaf {
+    static constexpr auto NO_CHILD = std::numeric_limits<size_t>::max();
+
+    explicit SearchLeaf(const GameState& root) : state(root) {}
+
+    SearchState state;
+    // Nodes visited under virtual loss, and the index of the child
+    // taken from each of them.
+    std::vector<std::pair<UCTNode*, size_t>> path;
+    SearchResult result;
+    // The last node of the path is being expanded and waits
+    // for its network evaluation.
+    bool pending{false};
+    bool new_node{false};
+    float min_psa_ratio{0.0f};
+};
+
 namespace TimeManagement {
     enum enabled_t {
         AUTO = -1, OFF = 0, ON = 1, FAST = 2, NO_PRUNING = 3
@@ -111,17 +139,53 @@ public:
         std::numeric_limits<int>::max() / 2;
 
     UCTSearch(GameState& g, Network& network);
+    ~UCTSearch();
     int think(int color, passflag_t passflag = NORMAL);
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
+    // Number of threads searching in think() and ponder().
+    void set_thread_limit(int threads);
+    // Other searches evaluate on the same network at the same time, see
+    // SelfPlay. Stopping then waits for the evaluations in flight rather
+    // than draining the network, which would halt theirs too.
+    void set_network_shared(bool shared);
     void ponder();
+    // Evaluate the likely next positions while waiting for the opponent,
+    // if not pondering.
+    void prefetch();
     bool is_running() const;
-    void increment_playouts();
+    // Write the search tree of the current position to a file, or make
+    // the tree in a file the root for the current position. The file
+    // also records the position and the weights it belongs to.
+    bool save_tree(const std::string& filename);
+    bool load_tree(const std::string& filename);
+    void increment_playouts(int playouts = 1);
+    void wake_controller();
     std::string explain_last_think() const;
-    SearchResult play_simulation(GameState& currstate, UCTNode* node);
+    SearchResult play_simulation(SearchState& currstate, UCTNode* node);
+    // Descends once for every leaf, then evaluates the leaves which need
+    // the network as one batch. Returns the number of playouts which
+    // produced a result.
+    int play_simulations(std::vector<SearchLeaf>& leaves, UCTNode* root);
+    // Delete a slice of the trees discarded by earlier searches.
+    void reclaim_nodes();
+    // Search the current position from scratch on the calling thread,
+    // until the root has the given number of visits. Many of these can
+    // run side by side, see BatchAnalysis.
+    void search_position(int visits);
+    // The root evaluation and the moves with visits, best first, as one
+    // JSON object.
+    std::string get_analysis_json();
 
 private:
     float get_min_psa_ratio() const;
+    // The thread running think(), ponder() or prefetch() sleeps until a
+    // worker, a timer or GTP input wakes it, see wake_controller().
+    void wait_for_event(int centis = -1);
+    void watch_input();
+    void schedule_check(int elapsed_centis, int time_for_move);
+    void descend(SearchLeaf& leaf, UCTNode* node);
+    void backup(const SearchLeaf& leaf);
     void dump_stats(const FastState& state, UCTNode& parent);
     void tree_stats(const UCTNode& node);
     std::string get_pv(FastState& state, const UCTNode& parent);
@@ -135,19 +199,49 @@ private:
     int get_best_move(passflag_t passflag);
     void update_root();
     bool advance_to_new_rootstate();
+    // Free the subtrees which were searched least recently, when pondering
+    // fills the tree. The workers must be stopped.
+    bool should_collect() const;
+    void collect_tree();
+    void reclaim_in_background();
+    // Wait for the workers after m_run is cleared, draining the network
+    // unless it is shared.
+    void stop_workers(Utils::ThreadGroup& tg);
+    std::vector<OutputAnalysisData> get_analysis_data(const FastState& state,
+                                                      const UCTNode& parent,
+                                                      size_t move_count);
     void output_analysis(const FastState& state, const UCTNode& parent);
 
     GameState& m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
-    std::unique_ptr<UCTNode> m_root;
+    UCTNodePointer::Root m_root;
+    TranspositionTable m_transpositions;
     std::atomic<int> m_nodes{0};
+    // Generation of this search's expansions, see UCTNode::create_children.
+    std::uint16_t m_expand_generation{0};
     std::atomic<int> m_playouts{0};
+    // Network batches submitted by play_simulations(), and their leaves.
+    std::atomic<int> m_leaf_batches{0};
+    std::atomic<int> m_batched_leaves{0};
     std::atomic<bool> m_run{false};
+    // Set while the workers are stopped for collect_tree().
+    std::atomic<bool> m_collecting{false};
+    bool m_collect_tree{false};
+    // Workers wake the controller when m_playouts reaches this.
+    std::atomic<int> m_check_playouts{0};
+    std::mutex m_controller_mutex;
+    std::condition_variable m_controller_cv;
+    bool m_controller_wake{false};
     int m_maxplayouts;
     int m_maxvisits;
+    int m_threads;
+    bool m_network_shared{false};
     std::string m_think_output;
 
-    std::list<Utils::ThreadGroup> m_delete_futures;
+    // Old trees, deleted by the workers a slice at a time, and between
+    // searches by a task on the thread pool.
+    TreeReclaimer m_reclaimer;
+    Utils::ThreadGroup m_reclaim_group;
 
     Network& m_network;
 };
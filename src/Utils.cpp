@@ -31,9 +31,11 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/math/distributions/students_t.hpp>
+#include <chrono>
 #include <cstdarg>
 #include <cstdio>
 #include <mutex>
+#include <thread>
 
 #include "Utils.h"
 
@@ -118,6 +120,26 @@ bool Utils::input_pending() {
 #endif
 }
 
+bool Utils::wait_for_input(const int timeout_ms) {
+#ifdef HAVE_SELECT
+    fd_set read_fds;
+    FD_ZERO(&read_fds);
+    FD_SET(0, &read_fds);
+    struct timeval timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    select(1, &read_fds, nullptr, nullptr, &timeout);
+    return FD_ISSET(0, &read_fds);
+#else
+    // No way to wait on a console or a pipe here, check every ms.
+    for (auto i = 0; i < timeout_ms; i++) {
+        if (input_pending()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return input_pending();
+#endif
+}
+
 static std::mutex IOmutex;
 
 static void myprintf_base(const char* const fmt, va_list ap) {
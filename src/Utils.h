@@ -33,7 +33,9 @@
 #include "config.h"
 
 #include <atomic>
+#include <istream>
 #include <limits>
+#include <ostream>
 #include <string>
 
 #include "ThreadPool.h"
@@ -48,6 +50,8 @@ namespace Utils {
     void gtp_fail_printf(int id, const char* fmt, ...);
     void log_input(const std::string& input);
     bool input_pending();
+    // Waits up to timeout_ms for GTP input, returns input_pending().
+    bool wait_for_input(int timeout_ms);
 
     template <class T>
     void atomic_add(std::atomic<T>& f, const T d) {
@@ -60,6 +64,17 @@ namespace Utils {
         return (x << k) | (x >> (std::numeric_limits<T>::digits - k));
     }
 
+    // Fixed-width fields in host byte order, for binary files that are
+    // read back on the same kind of machine.
+    template <typename T>
+    void write_binary(std::ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    template <typename T>
+    bool read_binary(std::istream& in, T& value) {
+        return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
     inline bool is7bit(const int c) {
         return c >= 0 && c <= 127;
     }
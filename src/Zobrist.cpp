@@ -31,12 +31,18 @@
 
 #include "Zobrist.h"
 
+#include "Network.h"
 #include "Random.h"
 
 std::array<std::array<std::uint64_t, FastBoard::NUM_VERTICES>,     4> Zobrist::zobrist;
 std::array<std::uint64_t, FastBoard::NUM_VERTICES>                    Zobrist::zobrist_ko;
 std::array<std::array<std::uint64_t, FastBoard::NUM_VERTICES * 2>, 2> Zobrist::zobrist_pris;
 std::array<std::uint64_t, 5>                                          Zobrist::zobrist_pass;
+std::array<std::array<Zobrist::SymmetryKeys, FastBoard::NUM_VERTICES>, 2> Zobrist::zobrist_sym;
+std::array<Zobrist::SymmetryKeys, FastBoard::NUM_VERTICES>                Zobrist::zobrist_sym_ko;
+
+static_assert(Zobrist::NUM_SYMMETRIES == Network::NUM_SYMMETRIES,
+              "Symmetry count mismatch");
 
 void Zobrist::init_zobrist(Random& rng) {
     for (int i = 0; i < 4; i++) {
@@ -58,4 +64,39 @@ void Zobrist::init_zobrist(Random& rng) {
     for (int i = 0; i < 5; i++) {
         Zobrist::zobrist_pass[i] = rng.randuint64();
     }
+
+    init_symmetry_keys();
+}
+
+void Zobrist::init_symmetry_keys() {
+    constexpr auto sidevertices = BOARD_SIZE + 2;
+
+    // Off-board vertices never hold stones, and NO_VERTEX (no ko)
+    // maps to itself under every symmetry.
+    for (int j = 0; j < FastBoard::NUM_VERTICES; j++) {
+        for (int s = 0; s < NUM_SYMMETRIES; s++) {
+            for (int c = 0; c < 2; c++) {
+                zobrist_sym[c][j][s] = 0;
+            }
+            zobrist_sym_ko[j][s] = zobrist_ko[FastBoard::NO_VERTEX];
+        }
+    }
+
+    for (int y = 0; y < BOARD_SIZE; y++) {
+        for (int x = 0; x < BOARD_SIZE; x++) {
+            const auto vertex = (y + 1) * sidevertices + (x + 1);
+            for (int s = 0; s < NUM_SYMMETRIES; s++) {
+                const auto newvtx =
+                    Network::get_symmetry({x, y}, s, BOARD_SIZE);
+                const auto symvertex =
+                    (newvtx.second + 1) * sidevertices + (newvtx.first + 1);
+                for (int c = 0; c < 2; c++) {
+                    zobrist_sym[c][vertex][s] =
+                        zobrist[FastBoard::EMPTY][symvertex]
+                        ^ zobrist[c][symvertex];
+                }
+                zobrist_sym_ko[vertex][s] = zobrist_ko[symvertex];
+            }
+        }
+    }
 }
@@ -47,7 +47,19 @@ public:
     static std::array<std::array<std::uint64_t, FastBoard::NUM_VERTICES * 2>, 2> zobrist_pris;
     static std::array<std::uint64_t, 5>                                          zobrist_pass;
 
+    // Keys of every vertex as seen through each board symmetry, for
+    // keeping symmetry hashes incrementally. Stone keys are stored
+    // relative to an empty point, with all symmetries of one vertex
+    // adjacent in memory. Only valid for a BOARD_SIZE board.
+    static constexpr auto NUM_SYMMETRIES = 8;
+    using SymmetryKeys = std::array<std::uint64_t, NUM_SYMMETRIES>;
+    static std::array<std::array<SymmetryKeys, FastBoard::NUM_VERTICES>, 2> zobrist_sym;
+    static std::array<SymmetryKeys, FastBoard::NUM_VERTICES>                zobrist_sym_ko;
+
     static void init_zobrist(Random& rng);
+
+private:
+    static void init_symmetry_keys();
 };
 
 #endif
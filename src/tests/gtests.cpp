@@ -29,19 +29,44 @@
 #include "config.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <regex>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
+#include <zlib.h>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
+#include "BatchAnalysis.h"
 #include "GTP.h"
 #include "GameState.h"
 #include "NNCache.h"
+#include "NodeArena.h"
 #include "Random.h"
+#include "SGFParser.h"
+#include "SelfPlay.h"
+#include "SearchState.h"
+#include "SMP.h"
+#include "SharedNNCache.h"
 #include "ThreadPool.h"
+#include "TranspositionTable.h"
+#include "TreeReclaimer.h"
+#include "UCTNode.h"
+#include "UCTSearch.h"
 #include "Utils.h"
 #include "Zobrist.h"
 
@@ -198,6 +223,144 @@ TEST_F(LeelaTest, KoPntNotSame) {
     EXPECT_NE(hash, maingame.board.get_hash());
 }
 
+TEST_F(LeelaTest, SymmetryHash) {
+    auto maingame = get_gamestate();
+
+    testing::internal::CaptureStdout();
+    GTP::execute(maingame, "play b Q16");
+    GTP::execute(maingame, "play w D4");
+    auto mirrored = get_gamestate();
+    GTP::execute(mirrored, "play b D16");
+    GTP::execute(mirrored, "play w Q4");
+    testing::internal::GetCapturedStdout();
+
+    EXPECT_EQ(maingame.get_symmetry_hash(Network::IDENTITY_SYMMETRY),
+              maingame.board.get_hash());
+    auto found = false;
+    for (auto sym = 0; sym < Network::NUM_SYMMETRIES; sym++) {
+        found |= maingame.get_symmetry_hash(sym) == mirrored.board.get_hash();
+    }
+    EXPECT_TRUE(found);
+
+    // The incremental hashes must match a full recalculation through
+    // captures, ko and passes.
+    for (auto i = 0; i < 300; i++) {
+        auto moves = std::vector<int>{};
+        for (auto vertex = 0; vertex < FastBoard::NUM_VERTICES; vertex++) {
+            if (maingame.is_move_legal(maingame.get_to_move(), vertex)) {
+                moves.emplace_back(vertex);
+            }
+        }
+        if (moves.empty() || i % 50 == 49) {
+            moves = {FastBoard::PASS};
+        }
+        maingame.play_move(moves[Random::get_Rng().randuint64(moves.size())]);
+
+        const auto& board = maingame.board;
+        for (auto sym = 0; sym < Network::NUM_SYMMETRIES; sym++) {
+            const auto komove = maingame.m_komove;
+            const auto expected = board.get_hash() ^ board.calc_hash(komove)
+                                  ^ board.calc_symmetry_hash(komove, sym);
+            ASSERT_EQ(maingame.get_symmetry_hash(sym), expected);
+        }
+    }
+}
+
+TEST_F(LeelaTest, CacheStats) {
+    auto result = gtp_execute("lz-cache_stats");
+    expect_regex(result.first, "^= size \\d+\ncapacity \\d+\n");
+    expect_regex(result.first, "\nmove_lookups( \\d+){16}\n");
+    expect_regex(result.first, "\ndepth_hits( \\d+){32}\n");
+    expect_regex(result.first, "\nage_hits( \\d+){24}\n\n$");
+
+    NNCache cache{100};
+    auto netresult = NNCache::Netresult{};
+    EXPECT_FALSE(cache.lookup(1, netresult, 32, 2));
+    cache.insert(1, netresult);
+    cache.insert(1, netresult);
+    cache.insert(2, netresult);
+    cache.insert(3, netresult);
+    EXPECT_TRUE(cache.lookup(1, netresult, 32, 2));
+    EXPECT_TRUE(cache.lookup(3, netresult, 60, 30, true));
+    EXPECT_TRUE(cache.lookup(2, netresult, 60));
+
+    const auto stats = cache.get_stats();
+    EXPECT_EQ(stats.size, 3);
+    EXPECT_EQ(stats.capacity, 100);
+    // Symmetry probes are only counted as such, and depth is only
+    // counted when it is known.
+    EXPECT_EQ(stats.lookups, 3);
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.symmetry_lookups, 1);
+    EXPECT_EQ(stats.symmetry_hits, 1);
+    EXPECT_EQ(stats.inserts, 3);
+    EXPECT_EQ(stats.duplicates, 1);
+    EXPECT_EQ(stats.move_lookups[1], 2);
+    EXPECT_EQ(stats.move_lookups[2], 1);
+    EXPECT_EQ(stats.move_hits[1], 1);
+    EXPECT_EQ(stats.move_hits[2], 1);
+    EXPECT_EQ(stats.depth_lookups[2], 2);
+    EXPECT_EQ(stats.depth_hits[2], 1);
+    EXPECT_EQ(stats.depth_hits[30], 0);
+    // Entries 1 and 2 are in the 2-3 inserts old bucket, entry 3 in 0-1.
+    EXPECT_EQ(stats.age_hits[1], 2);
+    EXPECT_EQ(stats.age_hits[0], 1);
+}
+
+TEST_F(LeelaTest, SearchStateMakeUnmake) {
+    auto& game = get_gamestate();
+    game.play_textmove("b", "D4");
+    game.play_textmove("w", "Q16");
+
+    auto state = SearchState{game};
+    auto reference = game;
+    const auto moves = {"Q4", "D16", "C3", "R17", "pass", "E5", "F6",
+                        "G7", "H8", "J9"};
+    for (const auto& move : moves) {
+        const auto vertex = game.board.text_to_move(move);
+        state.play_move(vertex);
+        reference.play_move(vertex);
+    }
+    EXPECT_EQ(state.board.get_hash(), reference.board.get_hash());
+    EXPECT_EQ(state.get_movenum(), reference.get_movenum());
+    // Network input comes partly from the ring buffer, partly from
+    // the root's history.
+    for (auto i = 0; i < Network::INPUT_MOVES; i++) {
+        EXPECT_EQ(state.get_past_board(i).get_hash(),
+                  reference.get_past_board(i).get_hash());
+    }
+    EXPECT_EQ(Network::gather_features(&state, 0),
+              Network::gather_features(&reference, 0));
+
+    // Only the moves in the ring buffer can be taken back.
+    for (auto i = 0; i < Network::INPUT_MOVES; i++) {
+        EXPECT_TRUE(state.undo_move());
+        reference.undo_move();
+        EXPECT_EQ(state.board.get_hash(), reference.board.get_hash());
+        EXPECT_EQ(state.get_passes(), reference.get_passes());
+    }
+    EXPECT_FALSE(state.undo_move());
+
+    state.reset(game);
+    EXPECT_EQ(state.board.get_hash(), game.board.get_hash());
+    EXPECT_FALSE(state.undo_move());
+}
+
+TEST_F(LeelaTest, SearchStateSuperko) {
+    auto& game = get_gamestate();
+    // Black captures at D4 first, and white can't take back at once.
+    for (const auto& move : {"D3", "E3", "C4", "F4", "D5", "E5", "Q16",
+                             "D4", "E4"}) {
+        game.play_move(game.board.text_to_move(move));
+    }
+    auto state = SearchState{game};
+    state.play_move(game.board.text_to_move("D4"));
+    EXPECT_TRUE(state.superko());
+    EXPECT_TRUE(state.undo_move());
+    state.play_move(game.board.text_to_move("Q4"));
+    EXPECT_FALSE(state.superko());
+}
+
 TEST_F(LeelaTest, MoveOnOccupiedPnt) {
     auto maingame = get_gamestate();
     std::string output;
@@ -376,3 +539,982 @@ TEST_F(LeelaTest, AnalyzeParseMinmoves) {
     // Expect to see at least 5 move priors
     expect_regex(result.first, "info.*?(prior\\s+\\d+\\s+.*?){5,}.*");
 }
+
+#ifndef _WIN32
+TEST(SharedNNCacheTest, SharedBetweenProcesses) {
+    // Random network hash, so concurrent test runs don't collide.
+    const auto net_hash = Random::get_Rng().randuint64();
+    auto cache = SharedNNCache::attach(net_hash, MiB);
+    ASSERT_TRUE(cache != nullptr);
+    EXPECT_EQ(cache->get_attached(), 1);
+
+    auto result = NNCache::Netresult{};
+    result.winrate = 0.25f;
+    result.policy[42] = 0.5f;
+    EXPECT_FALSE(cache->lookup(0x1234, result));
+
+    // A second process attaches to the same segment and fills it.
+    const auto pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+        auto child = SharedNNCache::attach(net_hash, MiB);
+        if (!child || child->get_attached() != 2) {
+            _exit(1);
+        }
+        child->insert(0x1234, result);
+        child.reset();
+        _exit(0);
+    }
+    auto status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+    EXPECT_EQ(cache->get_attached(), 1);
+
+    auto found = NNCache::Netresult{};
+    ASSERT_TRUE(cache->lookup(0x1234, found));
+    EXPECT_EQ(found.winrate, 0.25f);
+    EXPECT_EQ(found.policy[42], 0.5f);
+    EXPECT_FALSE(cache->lookup(0x4321, found));
+}
+#endif
+
+TEST(NodeArenaTest, ReusesFreedBlocks) {
+    auto node = NodeArena::allocate(64);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(node) % 16, 0);
+    NodeArena::deallocate(node, 64);
+    // Same size class, same thread: the block comes straight back.
+    EXPECT_EQ(NodeArena::allocate(60), node);
+    NodeArena::deallocate(node, 60);
+
+    // Blocks freed by another thread, as when a discarded subtree is
+    // destroyed in the background, are reused without new slabs.
+    auto blocks = std::vector<void*>(10000);
+    for (auto& block : blocks) {
+        block = NodeArena::allocate(64);
+    }
+    const auto reserved = NodeArena::get_reserved_size();
+    std::thread([&blocks]() {
+        for (auto block : blocks) {
+            NodeArena::deallocate(block, 64);
+        }
+    }).join();
+    for (auto& block : blocks) {
+        block = NodeArena::allocate(64);
+    }
+    EXPECT_EQ(NodeArena::get_reserved_size(), reserved);
+    for (auto block : blocks) {
+        NodeArena::deallocate(block, 64);
+    }
+
+    // The uncarved end of the slab of a thread which exits is handed
+    // to the next thread which needs one.
+    auto first = static_cast<void*>(nullptr);
+    std::thread([&first]() { first = NodeArena::allocate(11000); }).join();
+    const auto reserved_after_exit = NodeArena::get_reserved_size();
+    auto second = static_cast<void*>(nullptr);
+    std::thread([&second]() { second = NodeArena::allocate(12000); }).join();
+    EXPECT_EQ(NodeArena::get_reserved_size(), reserved_after_exit);
+    NodeArena::deallocate(first, 11000);
+    NodeArena::deallocate(second, 12000);
+}
+
+TEST_F(LeelaTest, SelectChildEdgeStats) {
+    // Wide root: every move on the empty board.
+    UCTNode root{FastBoard::PASS, 0.0f};
+    std::atomic<int> nodes{0};
+    auto eval = 0.0f;
+    auto& state = get_gamestate();
+    ASSERT_TRUE(root.create_children(*GTP::s_network, nodes, SearchState{state},
+                                     eval));
+    ASSERT_GE(root.get_children().size(), size_t{NUM_INTERSECTIONS});
+
+    const auto color = state.get_to_move();
+    constexpr auto SELECTIONS = 2000;
+    for (auto i = 0; i < SELECTIONS; i++) {
+        const auto index = root.uct_select_child(color, true);
+        root.child_virtual_loss_undo(index);
+        const auto& child = root.get_children()[index];
+        child.inflate();
+        // Some made up but stable evaluation.
+        const auto child_eval = 0.5f + 0.4f * std::sin(child->get_move());
+        child->update(child_eval);
+        root.update_child(index, child_eval);
+        root.update(child_eval);
+    }
+
+    // The edge statistics must agree with the child nodes.
+    const auto& children = root.get_children();
+    auto total_visits = 0;
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        const auto visits = children[i].get_visits();
+        EXPECT_EQ(children.get_visits(i), visits);
+        EXPECT_EQ(children.get_virtual_loss(i), 0);
+        if (visits > 0) {
+            EXPECT_DOUBLE_EQ(children.get_blackevals(i) / visits,
+                             children[i]->get_raw_eval(FastBoard::BLACK));
+        }
+        total_visits += visits;
+    }
+    EXPECT_EQ(total_visits, SELECTIONS);
+
+    // Reordering keeps the edge statistics with their child.
+    root.sort_children(color, 0.0f);
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        EXPECT_EQ(children.get_visits(i), children[i].get_visits());
+        EXPECT_EQ(children.get_policy(i), children[i].get_policy());
+    }
+}
+
+TEST_F(LeelaTest, SelectChildTotals) {
+    const auto& state = get_gamestate();
+    const auto color = state.get_to_move();
+    for (const auto moves : {8, 32, 128, NUM_INTERSECTIONS}) {
+        // Uniform policy over the first moves, the others are not linked.
+        auto netresult = Network::Netresult{};
+        std::fill_n(begin(netresult.policy), moves, 1.0f / moves);
+        netresult.winrate = 0.5f;
+        UCTNode node{FastBoard::PASS, 0.0f};
+        std::atomic<int> nodes{0};
+        auto eval = 0.0f;
+        ASSERT_TRUE(node.begin_expansion(SearchState{state}, 1e-6f));
+        node.finish_expansion(nodes, SearchState{state}, netresult, eval,
+                              1e-6f);
+        auto& children = node.get_children();
+        node.invalidate_child(children.size() - 1);
+
+        constexpr auto SELECTIONS = 2000;
+        for (auto i = 0; i < SELECTIONS; i++) {
+            const auto index = node.uct_select_child(color, false);
+            node.child_virtual_loss_undo(index);
+            const auto child_eval = 0.5f + 0.4f * std::sin(float(index));
+            node.update_child(index, child_eval);
+            node.update(child_eval);
+        }
+
+        // The running totals agree with the children.
+        auto total_visits = 0;
+        auto visited_policy = 0.0f;
+        for (auto i = size_t{0}; i < children.size(); i++) {
+            if (children.get_state(i) != UCTNodeChildren::INVALID
+                && children.get_visits(i) > 0) {
+                total_visits += children.get_visits(i);
+                visited_policy += children.get_policy(i);
+            }
+        }
+        EXPECT_EQ(children.get_total_visits(), SELECTIONS);
+        EXPECT_EQ(children.get_total_visits(), total_visits);
+        EXPECT_NEAR(children.get_visited_policy(), visited_policy, 1e-5f);
+    }
+}
+
+TEST_F(LeelaTest, LazyExpandStateReset) {
+    const auto state = SearchState{get_gamestate()};
+    auto netresult = Network::Netresult{};
+    netresult.policy.fill(0.001f);
+    netresult.policy[0] = 0.5f;
+    UCTNode node{FastBoard::PASS, 0.0f};
+    std::atomic<int> nodes{0};
+    auto eval = 0.0f;
+    ASSERT_TRUE(node.begin_expansion(state, 0.5f));
+    node.finish_expansion(nodes, state, netresult, eval, 0.5f);
+    EXPECT_EQ(node.count_nodes(), size_t{1});
+
+    // The skipped children can only be added by a later search, and
+    // only once per search.
+    EXPECT_FALSE(node.begin_expansion(state, 0.0f, 0));
+    ASSERT_TRUE(node.begin_expansion(state, 0.0f, 1));
+    node.finish_expansion(nodes, state, netresult, eval, 0.0f);
+    EXPECT_EQ(node.count_nodes(), size_t(nodes.load()));
+    EXPECT_GT(node.count_nodes(), size_t{1});
+    EXPECT_FALSE(node.begin_expansion(state, 0.0f, 1));
+}
+
+TEST_F(LeelaTest, ReclaimDeepTree) {
+    const auto state = SearchState{get_gamestate()};
+    auto netresult = Network::Netresult{};
+    netresult.policy.fill(0.001f);
+    netresult.policy[0] = 0.5f;
+    const auto tree_size = UCTNodePointer::get_tree_size();
+
+    // Deep enough that deleting it recursively would overflow the stack.
+    constexpr auto DEPTH = 200000;
+    auto root = UCTNodePointer::Root{new UCTNode(FastBoard::PASS, 0.0f)};
+    std::atomic<int> nodes{0};
+    auto eval = 0.0f;
+    auto node = root.get();
+    for (auto i = 0; i < DEPTH; i++) {
+        ASSERT_TRUE(node->begin_expansion(state, 0.5f));
+        node->finish_expansion(nodes, state, netresult, eval, 0.5f);
+        const auto& child = node->get_children()[0];
+        child.inflate();
+        node = child.get();
+    }
+
+    TreeReclaimer reclaimer;
+    reclaimer.add(std::move(root));
+    EXPECT_EQ(reclaimer.reclaim(1000), size_t{1000});
+    EXPECT_FALSE(reclaimer.empty());
+    EXPECT_EQ(reclaimer.reclaim_all(), size_t(DEPTH - 1000));
+    EXPECT_TRUE(reclaimer.empty());
+    EXPECT_EQ(reclaimer.get_stats().nodes.load(), DEPTH + 1);
+    EXPECT_EQ(UCTNodePointer::get_tree_size(), tree_size);
+}
+
+// The inflated node reached by moves from node, or nullptr.
+UCTNode* follow_line(UCTNode* node, const std::vector<int>& moves) {
+    for (const auto move : moves) {
+        auto next = static_cast<UCTNode*>(nullptr);
+        for (const auto& child : node->get_children()) {
+            if (child.get_move() == move && child.is_inflated()) {
+                next = child.get();
+            }
+        }
+        if (!next) {
+            return nullptr;
+        }
+        node = next;
+    }
+    return node;
+}
+
+// A tree in which D4 D16 Q16 Q4 and Q16 D16 D4 Q4 reach the same node.
+UCTNodePointer::Root make_transposed_tree(const GameState& start) {
+    auto netresult = Network::Netresult{};
+    netresult.policy.fill(0.001f);
+    TranspositionTable table;
+    table.reset(1024 * 1024);
+    std::atomic<int> nodes{0};
+    auto eval = 0.0f;
+
+    auto expand = [&](UCTNode* node, const GameState& state) {
+        EXPECT_TRUE(node->begin_expansion(SearchState{state}));
+        node->finish_expansion(nodes, SearchState{state}, netresult, eval);
+        for (const auto& child : node->get_children()) {
+            auto next = state;
+            next.play_move(child.get_move());
+            table.inflate(child, next.board.get_hash());
+        }
+    };
+    // Expand the nodes along a line of moves from the root.
+    auto root = UCTNodePointer::Root{new UCTNode(FastBoard::PASS, 0.0f)};
+    auto expand_line = [&](const std::vector<std::string>& moves) {
+        auto state = start;
+        auto node = root.get();
+        for (const auto& text : moves) {
+            const auto move = state.board.text_to_move(text);
+            if (node->get_children().empty()) {
+                expand(node, state);
+            }
+            node = follow_line(node, {move});
+            state.play_move(move);
+        }
+        expand(node, state);
+    };
+    expand_line({"D4", "D16", "Q16"});
+    expand_line({"Q16", "D16", "D4"});
+    EXPECT_GT(table.get_links(), size_t{0});
+    // Like UCTSearch, only keep the table during a search.
+    table.reset(0);
+    return root;
+}
+
+TEST_F(LeelaTest, ReclaimTransposedRoot) {
+    const auto tree_size = UCTNodePointer::get_tree_size();
+    const auto& start = get_gamestate();
+    const auto d4 = start.board.text_to_move("D4");
+    const auto d16 = start.board.text_to_move("D16");
+    const auto q16 = start.board.text_to_move("Q16");
+    const auto q4 = start.board.text_to_move("Q4");
+    auto root = make_transposed_tree(start);
+    const auto shared = follow_line(root.get(), {d4, d16, q16, q4});
+    ASSERT_NE(shared, nullptr);
+    ASSERT_EQ(shared, follow_line(root.get(), {q16, d16, d4, q4}));
+
+    // Advance as UCTSearch does, the old trees are still pending when
+    // the root reaches the shared node.
+    TreeReclaimer reclaimer;
+    for (const auto move : {d4, d16, q16, q4}) {
+        auto oldroot = std::move(root);
+        root = oldroot->find_child(move);
+        reclaimer.add(std::move(oldroot));
+        ASSERT_TRUE(root);
+    }
+    EXPECT_TRUE(root->is_shared());
+    reclaimer.reclaim_all();
+    EXPECT_FALSE(root->is_shared());
+    EXPECT_EQ(root.get(), shared);
+    root.reset();
+    EXPECT_EQ(UCTNodePointer::get_tree_size(), tree_size);
+}
+
+TEST_F(LeelaTest, RankChildrenByEdges) {
+    const auto& state = get_gamestate();
+    const auto color = state.get_to_move();
+    auto netresult = Network::Netresult{};
+    netresult.policy.fill(0.001f);
+    UCTNode root{FastBoard::PASS, 0.0f};
+    std::atomic<int> nodes{0};
+    auto eval = 0.0f;
+    ASSERT_TRUE(root.begin_expansion(SearchState{state}));
+    root.finish_expansion(nodes, SearchState{state}, netresult, eval);
+    root.inflate_all_children();
+    const auto& children = root.get_children();
+    const auto first_move = children[0].get_move();
+
+    // The second child is shared, and was mostly visited through
+    // other parents.
+    for (auto i = 0; i < 5; i++) {
+        root.update_child(0, 0.6f);
+        children[0]->update(0.6f);
+    }
+    for (auto i = 0; i < 2; i++) {
+        root.update_child(1, 0.9f);
+    }
+    for (auto i = 0; i < 50; i++) {
+        children[1]->update(0.9f);
+    }
+    EXPECT_EQ(root.get_max_child_visits(), 5);
+    EXPECT_EQ(root.get_best_root_child_index(color), size_t{0});
+    EXPECT_EQ(root.get_best_root_child(color).get_move(), first_move);
+    root.sort_children(color, 0.0f);
+    EXPECT_EQ(children[0].get_move(), first_move);
+    EXPECT_EQ(children.get_visits(0), 5);
+}
+
+TEST_F(LeelaTest, ParkedExpansionWait) {
+    const auto state = SearchState{get_gamestate()};
+    auto netresult = Network::Netresult{};
+    netresult.policy.fill(0.001f);
+    netresult.policy[0] = 0.5f;
+    UCTNode node{FastBoard::PASS, 0.0f};
+    std::atomic<int> nodes{0};
+    auto eval = 0.0f;
+    ASSERT_TRUE(node.begin_expansion(state, 0.5f));
+    node.finish_expansion(nodes, state, netresult, eval, 0.5f);
+    ASSERT_EQ(node.get_children().size(), size_t{1});
+
+    // Widening the node keeps it busy while another thread selects
+    // from it.
+    UCTNode::reset_expansion_wait_stats();
+    ASSERT_TRUE(node.begin_expansion(state, 0.0f, 1));
+    auto selector = std::thread([&node, &state]() {
+        const auto index = node.uct_select_child(state.get_to_move(), false);
+        node.child_virtual_loss_undo(index);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    node.finish_expansion(nodes, state, netresult, eval, 0.0f);
+    selector.join();
+
+    const auto& waits = UCTNode::get_expansion_wait_stats();
+    EXPECT_EQ(waits.waits.load(), 1);
+    EXPECT_EQ(waits.parked.load(), 1);
+    EXPECT_GT(waits.wait_ns.load(), 10'000'000);
+    EXPECT_GT(node.get_children().size(), size_t{1});
+}
+
+TEST_F(LeelaTest, GatherLeaves) {
+    auto& state = get_gamestate();
+    UCTSearch search{state, *GTP::s_network};
+    UCTNode root{FastBoard::PASS, 0.0f};
+    auto leaves = std::vector<SearchLeaf>{};
+    for (auto i = 0; i < 8; i++) {
+        leaves.emplace_back(state);
+    }
+
+    // The first batch can only expand the root, later ones are
+    // spread over different children by virtual loss.
+    EXPECT_EQ(search.play_simulations(leaves, &root), 1);
+    auto playouts = 1;
+    for (auto i = 0; i < 10; i++) {
+        const auto batch_playouts = search.play_simulations(leaves, &root);
+        EXPECT_GT(batch_playouts, 1);
+        playouts += batch_playouts;
+    }
+    EXPECT_EQ(root.get_visits(), playouts);
+
+    // All virtual losses are gone, and every playout went through
+    // a child after the first.
+    const auto& children = root.get_children();
+    auto total_visits = 0;
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        EXPECT_EQ(children.get_virtual_loss(i), 0);
+        EXPECT_EQ(children.get_visits(i), children[i].get_visits());
+        total_visits += children.get_visits(i);
+    }
+    EXPECT_EQ(total_visits, playouts - 1);
+}
+
+// Without transpositions, every edge counts the visits of its child.
+void expect_edges_match(const UCTNode& node) {
+    const auto& children = node.get_children();
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        if (children[i].is_inflated()) {
+            EXPECT_EQ(children.get_visits(i), children[i]->get_visits());
+            expect_edges_match(*children[i]);
+        } else {
+            EXPECT_EQ(children.get_visits(i), 0);
+        }
+    }
+}
+
+TEST_F(LeelaTest, CollapseColdSubtrees) {
+    auto& state = get_gamestate();
+    UCTSearch search{state, *GTP::s_network};
+    UCTNode root{FastBoard::PASS, 0.0f};
+    auto leaves = std::vector<SearchLeaf>{};
+    for (auto i = 0; i < 8; i++) {
+        leaves.emplace_back(state);
+    }
+    for (auto i = 0; i < 20; i++) {
+        search.play_simulations(leaves, &root);
+    }
+    // Only the most promising lines are searched in the new epoch.
+    UCTNodeChildren::advance_epoch();
+    for (auto i = 0; i < 3; i++) {
+        search.play_simulations(leaves, &root);
+    }
+
+    auto memory = std::map<std::uint32_t, size_t>{};
+    root.cold_memory(memory);
+    ASSERT_EQ(memory.size(), size_t{2});
+    const auto cold = memory.begin()->second;
+    const auto tree_size = UCTNodePointer::get_tree_size();
+    const auto& children = root.get_children();
+    auto visits = std::vector<int>{};
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        visits.emplace_back(children[i].get_visits());
+    }
+
+    root.collapse_cold(UCTNodeChildren::get_epoch());
+    EXPECT_EQ(tree_size - UCTNodePointer::get_tree_size(), cold);
+    // The collapsed nodes keep their statistics, and are expanded
+    // again by the search.
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        EXPECT_EQ(children[i].get_visits(), visits[i]);
+    }
+    const auto root_visits = root.get_visits();
+    for (auto i = 0; i < 20; i++) {
+        search.play_simulations(leaves, &root);
+    }
+    EXPECT_GT(root.get_visits(), root_visits);
+    EXPECT_EQ(children.get_total_visits(), root.get_visits() - 1);
+    expect_edges_match(root);
+
+    // Same when they are expanded again by single playouts.
+    UCTNodeChildren::advance_epoch();
+    root.collapse_cold(UCTNodeChildren::get_epoch());
+    auto currstate = SearchState{state};
+    for (auto i = 0; i < 50; i++) {
+        currstate.reset(state);
+        search.play_simulation(currstate, &root);
+    }
+    EXPECT_EQ(children.get_total_visits(), root.get_visits() - 1);
+    expect_edges_match(root);
+}
+
+TEST_F(LeelaTest, BatchAnalysis) {
+    const auto sgf_name = std::string{"leelaz_batch_test.sgf"};
+    const auto out_name = std::string{"leelaz_batch_test.jsonl"};
+    {
+        auto sgf = std::ofstream{sgf_name};
+        sgf << "(;GM[1]SZ[19]KM[7.5];B[pd];W[dp])";
+    }
+    ASSERT_TRUE(BatchAnalysis::run(*GTP::s_network, sgf_name, out_name, 8));
+
+    // One line for each position, in any order.
+    auto in = std::ifstream{out_name};
+    auto movenums = std::vector<int>{};
+    auto line = std::string{};
+    const auto format = std::regex{
+        "\\{\"file\":\"leelaz_batch_test.sgf\",\"game\":0,"
+        "\"movenum\":(\\d),\"to_move\":\"[BW]\",\"analysis\":"
+        "\\{\"visits\":(\\d+),\"winrate\":[0-9.]+,\"moves\":\\[.+\\]\\}\\}"};
+    while (std::getline(in, line)) {
+        auto match = std::smatch{};
+        ASSERT_TRUE(std::regex_match(line, match, format)) << line;
+        EXPECT_GE(std::stoi(match[2]), 8);
+        movenums.emplace_back(std::stoi(match[1]));
+    }
+    std::sort(begin(movenums), end(movenums));
+    EXPECT_EQ(movenums, (std::vector<int>{0, 1, 2}));
+
+    EXPECT_FALSE(BatchAnalysis::run(*GTP::s_network, "no_such_file.sgf",
+                                    out_name, 8));
+    std::remove(sgf_name.c_str());
+    std::remove(out_name.c_str());
+}
+
+TEST_F(LeelaTest, SelfPlay) {
+    const auto basename = std::string{"leelaz_selfplay_test"};
+    cfg_quiet = true;
+    SelfPlay::run(*GTP::s_network, 2, basename);
+    cfg_quiet = false;
+
+    const auto games = SGFParser::chop_all(basename + ".sgf");
+    EXPECT_EQ(games.size(), size_t{2});
+
+    // Both games are in the first chunk, 19 lines for every move.
+    const auto chunk_name = basename + ".0.gz";
+    auto chunk = gzopen(chunk_name.c_str(), "rb");
+    ASSERT_NE(chunk, nullptr);
+    auto lines = 0;
+    char buffer[4096];
+    while (gzgets(chunk, buffer, sizeof(buffer))) {
+        lines++;
+    }
+    gzclose(chunk);
+    EXPECT_GT(lines, 0);
+    EXPECT_EQ(lines % 19, 0);
+
+    std::remove((basename + ".sgf").c_str());
+    std::remove(chunk_name.c_str());
+}
+
+// Counts the drains, which on OpenCL halt the evaluations of every
+// search using the network.
+class DrainCountingNetwork : public Network {
+public:
+    virtual void drain_evals() {
+        m_drains++;
+        Network::drain_evals();
+    }
+    int get_drains() const {
+        return m_drains.load();
+    }
+
+private:
+    std::atomic<int> m_drains{0};
+};
+
+TEST_F(LeelaTest, SelfPlayDoesNotDrain) {
+    const auto basename = std::string{"leelaz_selfplay_drain_test"};
+    DrainCountingNetwork network;
+    network.initialize(std::min(cfg_max_playouts, cfg_max_visits),
+                       "../src/tests/0k.txt");
+    cfg_quiet = true;
+    SelfPlay::run(network, 1, basename);
+    cfg_quiet = false;
+    EXPECT_EQ(network.get_drains(), 0);
+
+    // A search which has the network to itself drains it to stop.
+    auto& state = get_gamestate();
+    UCTSearch search{state, network};
+    search.think(FastBoard::BLACK);
+    EXPECT_EQ(network.get_drains(), 1);
+
+    std::remove((basename + ".sgf").c_str());
+    std::remove((basename + ".0.gz").c_str());
+}
+
+TEST_F(LeelaTest, PlayoutCapRandomization) {
+    const auto basename = std::string{"leelaz_fast_visits_test"};
+    cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
+    cfg_max_visits = 50;
+    cfg_fast_visits = 2;
+    cfg_full_search_prob = 0.0f;
+    cfg_quiet = true;
+    SelfPlay::run(*GTP::s_network, 1, basename);
+    cfg_quiet = false;
+
+    // Every move got a fast search, so no sample has a policy target.
+    const auto chunk_name = basename + ".0.gz";
+    auto chunk = gzopen(chunk_name.c_str(), "rb");
+    ASSERT_NE(chunk, nullptr);
+    auto lines = 0;
+    char buffer[8192];
+    while (gzgets(chunk, buffer, sizeof(buffer))) {
+        if (lines++ % 19 == 17) {
+            auto probabilities = std::istringstream{buffer};
+            auto prob = 0.0f;
+            auto count = 0;
+            while (probabilities >> prob) {
+                EXPECT_EQ(prob, 0.0f);
+                count++;
+            }
+            EXPECT_EQ(count, POTENTIAL_MOVES);
+        }
+    }
+    gzclose(chunk);
+    EXPECT_GT(lines, 0);
+
+    std::remove((basename + ".sgf").c_str());
+    std::remove(chunk_name.c_str());
+}
+
+std::string read_gzip(const std::string& name) {
+    auto chunk = gzopen(name.c_str(), "rb");
+    auto data = std::string{};
+    char buffer[4096];
+    auto bytes = 0;
+    while ((bytes = gzread(chunk, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, bytes);
+    }
+    gzclose(chunk);
+    return data;
+}
+
+TEST_F(LeelaTest, BinaryTrainingChunks) {
+    gtp_execute("clear_board");
+    gtp_execute("genmove b");
+    gtp_execute("genmove w");
+    gtp_execute("genmove b");
+    gtp_execute("dump_training w leelaz_text_test");
+    cfg_binary_training = true;
+    cfg_training_compression = 1;
+    gtp_execute("dump_training w leelaz_v2_test");
+
+    auto text = std::istringstream{read_gzip("leelaz_text_test.0.gz")};
+    const auto binary = read_gzip("leelaz_v2_test.0.gz");
+
+    // The binary records hold the same samples as the text ones.
+    const auto plane_bytes = (16 * NUM_INTERSECTIONS + 7) / 8;
+    const auto record_size = 4 + 4 * POTENTIAL_MOVES + plane_bytes + 2;
+    ASSERT_EQ(binary.size(), 3 * record_size);
+    for (auto i = size_t{0}; i < 3; i++) {
+        const auto record = binary.substr(i * record_size, record_size);
+        EXPECT_EQ(record.substr(0, 4), std::string("\1\0\0\0", 4));
+        auto line = std::string{};
+        const auto planes = record.substr(4 + 4 * POTENTIAL_MOVES);
+        for (auto p = size_t{0}; p < 16; p++) {
+            std::getline(text, line);
+            ASSERT_EQ(line.size(), size_t{NUM_INTERSECTIONS / 4 + 1});
+            for (auto bit = size_t{0}; bit < NUM_INTERSECTIONS; bit++) {
+                const auto digit = std::stoi(line.substr(bit / 4, 1), 0, 16);
+                const auto text_bit = bit + 1 == NUM_INTERSECTIONS
+                                          ? digit
+                                          : (digit >> (3 - bit % 4)) & 1;
+                const auto index = p * NUM_INTERSECTIONS + bit;
+                const auto binary_bit =
+                    (planes[index / 8] >> (7 - index % 8)) & 1;
+                EXPECT_EQ(text_bit, binary_bit);
+            }
+        }
+        std::getline(text, line);
+        EXPECT_EQ(std::stoi(line), planes[plane_bytes]);
+        std::getline(text, line);
+        auto probabilities = std::istringstream{line};
+        for (auto j = size_t{0}; j < POTENTIAL_MOVES; j++) {
+            auto prob = 0.0f;
+            probabilities >> prob;
+            auto binary_prob = 0.0f;
+            std::memcpy(&binary_prob, record.data() + 4 + 4 * j, 4);
+            EXPECT_NEAR(prob, binary_prob, 1e-5f);
+        }
+        std::getline(text, line);
+        EXPECT_EQ(std::stoi(line) == 1, planes[plane_bytes + 1] == 1);
+    }
+
+    std::remove("leelaz_text_test.0.gz");
+    std::remove("leelaz_v2_test.0.gz");
+}
+
+TEST_F(LeelaTest, TrainingSpill) {
+    cfg_training_spill = ".";
+    gtp_execute("clear_board");
+    gtp_execute("genmove b");
+    gtp_execute("genmove w");
+    gtp_execute("dump_training b leelaz_spill_test");
+    gtp_execute("save_training leelaz_spill_test.txt");
+
+    // The save only refers to the spill file.
+    auto saved = std::ifstream{"leelaz_spill_test.txt"};
+    auto version = std::string{};
+    auto header = std::string{};
+    auto steps = 0;
+    auto spill_name = std::string{};
+    saved >> version >> header >> steps >> spill_name;
+    saved.close();
+    EXPECT_EQ(version, "v2");
+    EXPECT_EQ(header, "spill");
+    EXPECT_EQ(steps, 2);
+    ASSERT_TRUE(std::ifstream{spill_name}.good());
+
+    // Loading it without spilling gives the same training data.
+    cfg_training_spill.clear();
+    gtp_execute("clear_board");
+    EXPECT_TRUE(std::ifstream{spill_name}.good());
+    gtp_execute("load_training leelaz_spill_test.txt");
+    gtp_execute("dump_training b leelaz_memory_test");
+    const auto spilled = read_gzip("leelaz_spill_test.0.gz");
+    EXPECT_FALSE(spilled.empty());
+    EXPECT_EQ(spilled, read_gzip("leelaz_memory_test.0.gz"));
+    // The spill file is used up by loading it.
+    EXPECT_FALSE(std::ifstream{spill_name}.good());
+
+    // Loading the file this thread still appends to adds its steps once,
+    // and keeps the file.
+    cfg_training_spill = ".";
+    gtp_execute("clear_board");
+    gtp_execute("genmove b");
+    gtp_execute("save_training leelaz_spill_test.txt");
+    gtp_execute("load_training leelaz_spill_test.txt");
+    gtp_execute("save_training leelaz_spill_test.txt");
+    saved.open("leelaz_spill_test.txt");
+    saved >> version >> header >> steps >> spill_name;
+    saved.close();
+    EXPECT_EQ(steps, 2);
+    EXPECT_TRUE(std::ifstream{spill_name}.good());
+    cfg_training_spill.clear();
+    gtp_execute("clear_board");
+    gtp_execute("load_training leelaz_spill_test.txt");
+    EXPECT_FALSE(std::ifstream{spill_name}.good());
+
+    std::remove("leelaz_spill_test.0.gz");
+    std::remove("leelaz_memory_test.0.gz");
+    std::remove("leelaz_spill_test.txt");
+    std::remove(spill_name.c_str());
+}
+
+TEST_F(LeelaTest, LoadTrainingVersion1) {
+    const auto filename = std::string{"leelaz_training_test.txt"};
+    gtp_execute("clear_board");
+    gtp_execute("genmove b");
+    gtp_execute("genmove w");
+    gtp_execute("save_training " + filename);
+    auto saved = std::stringstream{};
+    saved << std::ifstream{filename}.rdbuf();
+
+    // Saves from before full_search have no version, and their steps
+    // end before the flag.
+    auto version = std::string{};
+    auto old_save = std::string{};
+    auto line = std::string{};
+    saved >> version >> std::ws;
+    EXPECT_EQ(version, "v2");
+    while (std::getline(saved, line)) {
+        ASSERT_EQ(line.substr(line.size() - 2), " 1");
+        old_save += line.substr(0, line.size() - 2) + "\n";
+    }
+    std::ofstream{filename} << old_save;
+
+    gtp_execute("clear_board");
+    gtp_execute("load_training " + filename);
+    gtp_execute("save_training " + filename);
+    auto resaved = std::stringstream{};
+    resaved << std::ifstream{filename}.rdbuf();
+    EXPECT_EQ(resaved.str(), saved.str());
+
+    std::remove(filename.c_str());
+}
+
+TEST_F(LeelaTest, SaveLoadTree) {
+    auto& state = get_gamestate();
+    UCTSearch search{state, *GTP::s_network};
+    UCTNode root{FastBoard::PASS, 0.0f};
+    auto leaves = std::vector<SearchLeaf>{};
+    for (auto i = 0; i < 8; i++) {
+        leaves.emplace_back(state);
+    }
+    for (auto i = 0; i < 20; i++) {
+        search.play_simulations(leaves, &root);
+    }
+
+    auto saved = std::stringstream{};
+    root.save_subtree(saved);
+    UCTNode loaded{FastBoard::PASS, 0.0f};
+    ASSERT_TRUE(loaded.load_subtree(saved));
+    EXPECT_EQ(loaded.get_visits(), root.get_visits());
+    EXPECT_EQ(loaded.get_eval(FastBoard::BLACK),
+              root.get_eval(FastBoard::BLACK));
+    const auto& children = root.get_children();
+    const auto& loaded_children = loaded.get_children();
+    ASSERT_EQ(loaded_children.size(), children.size());
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        EXPECT_EQ(loaded_children[i].get_move(), children[i].get_move());
+        EXPECT_EQ(loaded_children.get_visits(i), children.get_visits(i));
+        EXPECT_EQ(loaded_children.get_policy(i), children.get_policy(i));
+        EXPECT_EQ(loaded_children[i].is_inflated(), children[i].is_inflated());
+    }
+    // Saving the copy gives the same bytes.
+    auto resaved = std::stringstream{};
+    loaded.save_subtree(resaved);
+    EXPECT_EQ(resaved.str(), saved.str());
+
+    // A node shared through a transposition is written once, and loaded
+    // back shared.
+    const auto& start = get_gamestate();
+    const auto d4 = start.board.text_to_move("D4");
+    const auto d16 = start.board.text_to_move("D16");
+    const auto q16 = start.board.text_to_move("Q16");
+    const auto q4 = start.board.text_to_move("Q4");
+    auto transposed = make_transposed_tree(start);
+    auto shared_saved = std::stringstream{};
+    transposed->save_subtree(shared_saved);
+    UCTNode shared_loaded{FastBoard::PASS, 0.0f};
+    ASSERT_TRUE(shared_loaded.load_subtree(shared_saved));
+    EXPECT_EQ(shared_loaded.count_nodes(), transposed->count_nodes());
+    const auto shared = follow_line(&shared_loaded, {d4, d16, q16, q4});
+    ASSERT_NE(shared, nullptr);
+    EXPECT_EQ(shared, follow_line(&shared_loaded, {q16, d16, d4, q4}));
+    EXPECT_TRUE(shared->is_shared());
+    auto shared_resaved = std::stringstream{};
+    shared_loaded.save_subtree(shared_resaved);
+    EXPECT_EQ(shared_resaved.str(), shared_saved.str());
+
+    // Truncated data is rejected.
+    auto truncated = std::stringstream{
+        saved.str().substr(0, saved.str().size() / 2)};
+    UCTNode partial{FastBoard::PASS, 0.0f};
+    EXPECT_FALSE(partial.load_subtree(truncated));
+
+    // A tree file only loads for the position it was saved in.
+    const auto filename = std::string{"leelaz_tree_test.bin"};
+    EXPECT_EQ(gtp_execute("lz-save_tree " + filename).first, "= \n\n");
+    gtp_execute("play b d4");
+    EXPECT_EQ(gtp_execute("lz-load_tree " + filename).first[0], '?');
+    gtp_execute("undo");
+    EXPECT_EQ(gtp_execute("lz-load_tree " + filename).first, "= \n\n");
+    std::remove(filename.c_str());
+}
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+    Utils::ThreadPool pool;
+    pool.initialize(4);
+    std::atomic<int> count{0};
+    {
+        // Tasks queued from outside the pool.
+        Utils::ThreadGroup tg(pool);
+        for (auto i = 0; i < 10000; i++) {
+            tg.add_task([&count]() { count++; });
+        }
+        tg.wait_all();
+    }
+    EXPECT_EQ(count.load(), 10000);
+    count = 0;
+    {
+        // Tasks queued from inside the pool go to the worker's own deque.
+        Utils::ThreadGroup tg(pool);
+        for (auto i = 0; i < 100; i++) {
+            tg.add_task([&pool, &count]() {
+                Utils::ThreadGroup nested(pool);
+                for (auto j = 0; j < 10; j++) {
+                    nested.add_task([&count]() { count++; });
+                }
+                nested.wait_all();
+            });
+        }
+        tg.wait_all();
+    }
+    EXPECT_EQ(count.load(), 1000);
+
+    Utils::ThreadGroup tg(pool);
+    tg.add_task([]() { throw std::runtime_error("task failed"); });
+    EXPECT_THROW(tg.wait_all(), std::runtime_error);
+
+    // A waiting worker only runs the tasks of the group it waits for.
+    Utils::ThreadPool single;
+    single.initialize(1);
+    Utils::ThreadGroup other(single);
+    std::atomic<bool> other_ran{false};
+    auto other_ran_first = true;
+    Utils::ThreadGroup outer(single);
+    outer.add_task([&]() {
+        Utils::ThreadGroup own(single);
+        own.add_task([&]() { other_ran_first = other_ran.load(); });
+        other.add_task([&]() { other_ran = true; });
+        own.wait_all();
+    });
+    outer.wait_all();
+    other.wait_all();
+    EXPECT_FALSE(other_ran_first);
+    EXPECT_TRUE(other_ran.load());
+}
+
+TEST_F(LeelaTest, LockProfile) {
+    gtp_execute("lz-lock_profile reset");
+    EXPECT_EQ(gtp_execute("lz-lock_profile on").first, "= \n\n");
+
+    SMP::Mutex mutex;
+    auto counter = 0;
+    constexpr auto THREADS = 4;
+    constexpr auto ITERATIONS = 20000;
+    auto workers = std::vector<std::thread>{};
+    for (auto t = 0; t < THREADS; t++) {
+        workers.emplace_back([&mutex, &counter]() {
+            for (auto i = 0; i < ITERATIONS; i++) {
+                LOCK(mutex, lock);
+                counter++;
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    gtp_execute("lz-lock_profile off");
+    EXPECT_EQ(counter, THREADS * ITERATIONS);
+
+    const auto profile = SMP::get_lock_profile();
+    const auto site = std::find_if(
+        begin(profile), end(profile), [](const auto& site) {
+            return site.site.find("gtests.cpp") == 0;
+        });
+    ASSERT_NE(site, end(profile));
+    EXPECT_EQ(site->acquires, std::uint64_t{THREADS * ITERATIONS});
+    EXPECT_LE(site->contended, site->acquires);
+
+    const auto report = gtp_execute("lz-lock_profile").first;
+    expect_regex(report, "profiling off");
+    expect_regex(report, "gtests.cpp:[0-9]+ acquires 80000 contended");
+}
+
+TEST(TreeSizeTest, BalancedAcrossThreads) {
+    // Expansion-like churn of child arrays and nodes, which updates the
+    // tree size for every pointer and node.
+    const auto tree_size = UCTNodePointer::get_tree_size();
+    constexpr auto THREADS = 4;
+    constexpr auto EXPANSIONS = 2000;
+    auto workers = std::vector<std::thread>{};
+    for (auto t = 0; t < THREADS; t++) {
+        workers.emplace_back([]() {
+            for (auto i = 0; i < EXPANSIONS; i++) {
+                UCTNodeChildren children;
+                children.reserve(32);
+                for (auto move = 0; move < 32; move++) {
+                    children.emplace_back(move, 1.0f / 32);
+                }
+                for (auto move = 0; move < 4; move++) {
+                    children[move].inflate();
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    EXPECT_EQ(UCTNodePointer::get_tree_size(), tree_size);
+}
+
+TEST(TranspositionTableTest, SharesNodes) {
+    const auto tree_size = UCTNodePointer::get_tree_size();
+    TranspositionTable table;
+    table.reset(64 * 1024);
+    ASSERT_TRUE(table.enabled());
+    {
+        // Two parents playing the same move into the same position, a
+        // different move into it, which can't share the node, and
+        // another position.
+        UCTNodePointer first{42, 0.5f};
+        UCTNodePointer second{42, 0.25f};
+        UCTNodePointer different{43, 0.25f};
+        UCTNodePointer other{44, 0.125f};
+        table.inflate(first, 0x1234);
+        table.inflate(second, 0x1234);
+        table.inflate(different, 0x1234);
+        table.inflate(other, 0x4321);
+        EXPECT_EQ(first.get(), second.get());
+        EXPECT_NE(first.get(), different.get());
+        EXPECT_EQ(different.get_move(), 43);
+        EXPECT_NE(first.get(), other.get());
+        EXPECT_EQ(table.get_links(), size_t{1});
+        EXPECT_TRUE(first->is_shared());
+        // The table's own reference doesn't make a node shared.
+        EXPECT_FALSE(different->is_shared());
+        EXPECT_FALSE(other->is_shared());
+    }
+    // The table keeps its nodes alive until it is emptied.
+    EXPECT_GT(UCTNodePointer::get_tree_size(), tree_size);
+    table.reset(0);
+    EXPECT_FALSE(table.enabled());
+    EXPECT_EQ(UCTNodePointer::get_tree_size(), tree_size);
+}